@@ -40,6 +40,8 @@ volatile: A volatile specifier is a hint to a compiler that an object may change
 #define VGACTL_ADDR     (DEVICE_BASE + 0x0000100)
 #define AUDIO_ADDR      (DEVICE_BASE + 0x0000200)
 #define DISK_ADDR       (DEVICE_BASE + 0x0000300)
+#define GPU_ADDR        (DEVICE_BASE + 0x0000180)
+#define NET_ADDR        (DEVICE_BASE + 0x0000400)
 #define FB_ADDR         (MMIO_BASE   + 0x1000000)
 #define AUDIO_SBUF_ADDR (MMIO_BASE   + 0x1200000)
 
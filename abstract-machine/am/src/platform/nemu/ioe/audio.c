@@ -8,19 +8,43 @@
 #define AUDIO_INIT_ADDR      (AUDIO_ADDR + 0x10)
 #define AUDIO_COUNT_ADDR     (AUDIO_ADDR + 0x14)
 
+// the samples are appended to the ring in sbuf, then published by writing
+// their number to the count register
+static int sbuf_size = 0;
+static int sbuf_pos = 0;
+
 void __am_audio_init() {
+  sbuf_size = inl(AUDIO_SBUF_SIZE_ADDR);
 }
 
 void __am_audio_config(AM_AUDIO_CONFIG_T *cfg) {
-  cfg->present = false;
+  cfg->present = true;
+  cfg->bufsize = sbuf_size;
 }
 
 void __am_audio_ctrl(AM_AUDIO_CTRL_T *ctrl) {
+  outl(AUDIO_FREQ_ADDR, ctrl->freq);
+  outl(AUDIO_CHANNELS_ADDR, ctrl->channels);
+  outl(AUDIO_SAMPLES_ADDR, ctrl->samples);
+  outl(AUDIO_INIT_ADDR, 1);
 }
 
 void __am_audio_status(AM_AUDIO_STATUS_T *stat) {
-  stat->count = 0;
+  stat->count = inl(AUDIO_COUNT_ADDR);
 }
 
 void __am_audio_play(AM_AUDIO_PLAY_T *ctl) {
+  uint8_t *p = ctl->buf.start, *end = ctl->buf.end;
+  while (p < end) {
+    int len = end - p;
+    if (len > sbuf_size) len = sbuf_size;
+    while (sbuf_size - (int)inl(AUDIO_COUNT_ADDR) < len) ; // wait for the space
+    uint8_t *sbuf = (uint8_t *)AUDIO_SBUF_ADDR;
+    for (int i = 0; i < len; i ++) {
+      sbuf[sbuf_pos] = p[i];
+      sbuf_pos = (sbuf_pos + 1) % sbuf_size;
+    }
+    outl(AUDIO_COUNT_ADDR, len);
+    p += len;
+  }
 }
@@ -1,20 +1,57 @@
 #include <am.h>
 #include <nemu.h>
 
-#define SYNC_ADDR (VGACTL_ADDR + 4)
+#define SYNC_ADDR  (VGACTL_ADDR + 4)
+#define GMEM_ADDR  (VGACTL_ADDR + 8) // size of the GPU memory, 0 without the accelerator
+
+#define GPU_CMD_ADDR    (GPU_ADDR + 0x00)
+#define GPU_STATUS_ADDR (GPU_ADDR + 0x04)
+#define GPU_SRC_ADDR    (GPU_ADDR + 0x08)
+#define GPU_DST_ADDR    (GPU_ADDR + 0x0c)
+#define GPU_SIZE_ADDR   (GPU_ADDR + 0x10)
+#define GPU_X_ADDR      (GPU_ADDR + 0x14)
+#define GPU_Y_ADDR      (GPU_ADDR + 0x18)
+#define GPU_W_ADDR      (GPU_ADDR + 0x1c)
+#define GPU_H_ADDR      (GPU_ADDR + 0x20)
+
+#define GPU_CMD_MEMCPY 1
+#define GPU_CMD_RENDER 2
+#define GPU_CMD_BLIT   4
+
+static bool has_accel = false;
 
 void __am_gpu_init() {
+  has_accel = inl(GMEM_ADDR) != 0;
 }
 
 void __am_gpu_config(AM_GPU_CONFIG_T *cfg) {
+  uint32_t wh = inl(VGACTL_ADDR);
+  int w = wh >> 16, h = wh & 0xffff;
   *cfg = (AM_GPU_CONFIG_T) {
-    .present = true, .has_accel = false,
-    .width = 0, .height = 0,
-    .vmemsz = 0
+    .present = true, .has_accel = has_accel,
+    .width = w, .height = h,
+    .vmemsz = has_accel ? inl(GMEM_ADDR) : w * h * sizeof(uint32_t)
   };
 }
 
+// NEMU only uploads the rows written since the last sync
 void __am_gpu_fbdraw(AM_GPU_FBDRAW_T *ctl) {
+  if (has_accel) {
+    // the accelerator copies the whole picture
+    outl(GPU_SRC_ADDR, (uintptr_t)ctl->pixels);
+    outl(GPU_X_ADDR, ctl->x);
+    outl(GPU_Y_ADDR, ctl->y);
+    outl(GPU_W_ADDR, ctl->w);
+    outl(GPU_H_ADDR, ctl->h);
+    outl(GPU_CMD_ADDR, GPU_CMD_BLIT);
+  } else {
+    int screen_w = inl(VGACTL_ADDR) >> 16;
+    uint32_t *fb = (uint32_t *)(uintptr_t)FB_ADDR + ctl->y * screen_w + ctl->x;
+    const uint32_t *pixels = ctl->pixels;
+    for (int j = 0; j < ctl->h; j ++, fb += screen_w, pixels += ctl->w) {
+      for (int i = 0; i < ctl->w; i ++) fb[i] = pixels[i];
+    }
+  }
   if (ctl->sync) {
     outl(SYNC_ADDR, 1);
   }
@@ -23,3 +60,18 @@ void __am_gpu_fbdraw(AM_GPU_FBDRAW_T *ctl) {
 void __am_gpu_status(AM_GPU_STATUS_T *status) {
   status->ready = true;
 }
+
+void __am_gpu_memcpy(AM_GPU_MEMCPY_T *params) {
+  panic_on(!has_accel, "no GPU accelerator");
+  outl(GPU_SRC_ADDR, (uintptr_t)params->src);
+  outl(GPU_DST_ADDR, params->dest);
+  outl(GPU_SIZE_ADDR, params->size);
+  outl(GPU_CMD_ADDR, GPU_CMD_MEMCPY);
+}
+
+void __am_gpu_render(AM_GPU_RENDER_T *params) {
+  panic_on(!has_accel, "no GPU accelerator");
+  outl(GPU_DST_ADDR, params->root);
+  outl(GPU_CMD_ADDR, GPU_CMD_RENDER);
+  outl(SYNC_ADDR, 1);
+}
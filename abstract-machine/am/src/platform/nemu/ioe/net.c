@@ -0,0 +1,84 @@
+#include <am.h>
+#include <nemu.h>
+#include <klib.h>
+
+#define NET_FRAME_MAX_ADDR (NET_ADDR + 0x00)
+#define NET_TX_RING_ADDR   (NET_ADDR + 0x04)
+#define NET_TX_SIZE_ADDR   (NET_ADDR + 0x08)
+#define NET_TX_TAIL_ADDR   (NET_ADDR + 0x10)
+#define NET_RX_RING_ADDR   (NET_ADDR + 0x14)
+#define NET_RX_SIZE_ADDR   (NET_ADDR + 0x18)
+#define NET_RX_HEAD_ADDR   (NET_ADDR + 0x1c)
+#define NET_RX_TAIL_ADDR   (NET_ADDR + 0x20)
+
+#define NR_DESC  8
+#define BUF_SIZE 1536
+
+typedef struct {
+  uint32_t addr;
+  uint16_t len;
+  uint16_t flags;
+} net_desc;
+
+// the device writes the descriptors and the buffers behind the back of the compiler
+static volatile net_desc tx_ring[NR_DESC], rx_ring[NR_DESC];
+static uint8_t rx_buf[NR_DESC][BUF_SIZE];
+static uint32_t tx_tail = 0, rx_next = 0;
+static int frame_max = -1;
+
+// the rings are set up at the first use, so that a program without network
+// does not touch the device
+static void net_init() {
+  if (frame_max >= 0) return;
+  frame_max = inl(NET_FRAME_MAX_ADDR);
+  outl(NET_TX_RING_ADDR, (uintptr_t)tx_ring);
+  outl(NET_TX_SIZE_ADDR, NR_DESC);
+  for (int i = 0; i < NR_DESC; i ++) {
+    rx_ring[i].addr = (uintptr_t)rx_buf[i];
+    rx_ring[i].len = BUF_SIZE;
+    rx_ring[i].flags = 0;
+  }
+  outl(NET_RX_RING_ADDR, (uintptr_t)rx_ring);
+  outl(NET_RX_SIZE_ADDR, NR_DESC);
+  outl(NET_RX_TAIL_ADDR, rx_next + NR_DESC);
+}
+
+void __am_net_config(AM_NET_CONFIG_T *cfg) {
+  net_init();
+  cfg->present = frame_max > 0;
+}
+
+void __am_net_status(AM_NET_STATUS_T *stat) {
+  net_init();
+  stat->rx_len = (rx_next != inl(NET_RX_HEAD_ADDR)) ? rx_ring[rx_next % NR_DESC].len : 0;
+  stat->tx_len = frame_max;
+}
+
+// the device sends the frame from `buf` before returning, so it can be reused
+void __am_net_tx(AM_NET_TX_T *tx) {
+  net_init();
+  volatile net_desc *d = &tx_ring[tx_tail % NR_DESC];
+  d->addr = (uintptr_t)tx->buf.start;
+  d->len = (uint8_t *)tx->buf.end - (uint8_t *)tx->buf.start;
+  d->flags = 0;
+  outl(NET_TX_TAIL_ADDR, ++ tx_tail);
+}
+
+// receive the next frame into `buf`, which should hold rx_len bytes of
+// AM_NET_STATUS. `buf.end` is moved to the end of the frame.
+void __am_net_rx(AM_NET_RX_T *rx) {
+  net_init();
+  if (rx_next == inl(NET_RX_HEAD_ADDR)) {
+    rx->buf.end = rx->buf.start;
+    return;
+  }
+  int idx = rx_next % NR_DESC;
+  size_t len = rx_ring[idx].len, size = (uint8_t *)rx->buf.end - (uint8_t *)rx->buf.start;
+  if (len > size) len = size;
+  memcpy(rx->buf.start, rx_buf[idx], len);
+  rx->buf.end = (uint8_t *)rx->buf.start + len;
+  rx_ring[idx].len = BUF_SIZE;
+  rx_ring[idx].flags = 0;
+  rx_next ++;
+  outl(NET_RX_TAIL_ADDR, rx_next + NR_DESC);
+}
@@ -0,0 +1,22 @@
+#include <am.h>
+#include <nemu.h>
+
+#define UART_RBR_ADDR (SERIAL_PORT + 0)
+#define UART_THR_ADDR (SERIAL_PORT + 0)
+#define UART_LSR_ADDR (SERIAL_PORT + 5)
+
+#define LSR_DR   0x01
+#define LSR_THRE 0x20
+
+void __am_uart_config(AM_UART_CONFIG_T *cfg) {
+  cfg->present = true;
+}
+
+void __am_uart_tx(AM_UART_TX_T *send) {
+  while (!(inb(UART_LSR_ADDR) & LSR_THRE)) ;
+  outb(UART_THR_ADDR, send->data);
+}
+
+void __am_uart_rx(AM_UART_RX_T *recv) {
+  recv->data = (inb(UART_LSR_ADDR) & LSR_DR) ? inb(UART_RBR_ADDR) : -1;
+}
@@ -19,26 +19,56 @@
 #include <common.h>
 #include <difftest-def.h>
 
+struct Decode;
+
 #ifdef CONFIG_DIFFTEST
 void difftest_skip_ref();
 void difftest_skip_dut(int nr_ref, int nr_dut);
 void difftest_set_patch(void (*fn)(void *arg), void *arg);
-void difftest_step(vaddr_t pc, vaddr_t npc);
+void difftest_step(struct Decode *s, vaddr_t npc);
 void difftest_detach();
 void difftest_attach();
+void difftest_log_store(paddr_t addr, int len, word_t data);
+void difftest_mmio(paddr_t addr, int len, word_t data, bool is_write);
+void difftest_dma(paddr_t addr, size_t len);
+void difftest_intr(word_t NO);
+void difftest_get_ref_regs(void *ref_r, const void *dut);
+void difftest_report(const void *ref, vaddr_t pc);
+void iqueue_commit(struct Decode *s);
+void iqueue_rewind(uint64_t n);
+extern bool difftest_trace_window;
 #else
 static inline void difftest_skip_ref() {}
 static inline void difftest_skip_dut(int nr_ref, int nr_dut) {}
 static inline void difftest_set_patch(void (*fn)(void *arg), void *arg) {}
-static inline void difftest_step(vaddr_t pc, vaddr_t npc) {}
+static inline void difftest_step(struct Decode *s, vaddr_t npc) {}
 static inline void difftest_detach() {}
 static inline void difftest_attach() {}
+static inline void difftest_log_store(paddr_t addr, int len, word_t data) {}
+static inline void difftest_mmio(paddr_t addr, int len, word_t data, bool is_write) {}
+static inline void difftest_dma(paddr_t addr, size_t len) {}
+#endif
+
+#ifdef CONFIG_DIFFTEST_PIPELINE
+void difftest_pipe_init();
+void difftest_pipe_commit(struct Decode *s);
+void difftest_pipe_store(paddr_t addr, int len, word_t data);
+void difftest_pipe_skip_ref();
+void difftest_pipe_mmio_load(paddr_t addr, int len, word_t data);
+void difftest_pipe_sync();
+void difftest_pipe_intr();
 #endif
 
 extern void (*ref_difftest_memcpy)(paddr_t addr, void *buf, size_t n, bool direction);
 extern void (*ref_difftest_regcpy)(void *dut, bool direction);
 extern void (*ref_difftest_exec)(uint64_t n);
 extern void (*ref_difftest_raise_intr)(uint64_t NO);
+extern void (*ref_difftest_mmio_load)(paddr_t addr, int len, word_t data);
+extern void (*ref_difftest_regcpy_mask)(void *dut, uint64_t mask, bool direction);
+extern void (*ref_difftest_exec_trace)(const uint64_t *pc, uint64_t n);
+extern uint64_t (*ref_difftest_exec_hash)(uint64_t n);
+extern bool (*ref_difftest_share_mem)(void *dut_pmem, paddr_t base, size_t size);
+extern int (*ref_difftest_shared_store)(paddr_t *addr, word_t *data);
 
 static inline bool difftest_check_reg(const char *name, vaddr_t pc, word_t ref, word_t dut) {
   if (ref != dut) {
@@ -21,4 +21,21 @@
 typedef void (*alarm_handler_t) ();
 void add_alarm_handle(alarm_handler_t h);
 
+#ifdef CONFIG_TIMER_ICOUNT
+#define ICOUNT_PER_ALARM (CONFIG_ICOUNT_FREQ / TIMER_HZ)
+
+// guest time in us, without asking the host
+static inline uint64_t icount_time() {
+  extern uint64_t g_nr_guest_inst;
+  uint64_t n = g_nr_guest_inst;
+  return n / CONFIG_ICOUNT_FREQ * 1000000 + n % CONFIG_ICOUNT_FREQ * 1000000 / CONFIG_ICOUNT_FREQ;
+}
+
+// the first instruction count at which icount_time() reaches `us`
+static inline uint64_t icount_at(uint64_t us) {
+  if (us / 1000000 >= UINT64_MAX / CONFIG_ICOUNT_FREQ) return UINT64_MAX;
+  return us / 1000000 * CONFIG_ICOUNT_FREQ + (us % 1000000 * CONFIG_ICOUNT_FREQ + 999999) / 1000000;
+}
+#endif
+
 #endif
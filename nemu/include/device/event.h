@@ -0,0 +1,59 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __DEVICE_EVENT_H__
+#define __DEVICE_EVENT_H__
+
+#include <common.h>
+
+/*
+The devices schedule their work as events at a deadline, either a guest instruction
+count or a host time in us as returned by get_time(). The CPU loop only compares
+g_nr_guest_inst with g_event_deadline after each instruction, and calls
+device_update() when it is reached. The host events are checked every HOST_POLL
+instructions while there are some.
+*/
+enum { EVENT_ICOUNT, EVENT_HOST, NR_EVENT_CLOCK };
+
+typedef void (*event_handler_t) ();
+
+typedef struct {
+  const char *name;
+  int clock;
+  event_handler_t handler;
+  uint64_t when;
+  int idx; // position in the queue, -1 if not scheduled
+} event_t;
+
+extern volatile uint64_t g_event_deadline;
+
+static inline bool event_due() {
+  extern uint64_t g_nr_guest_inst;
+  return g_nr_guest_inst >= g_event_deadline;
+}
+
+void event_init(event_t *e, const char *name, int clock, event_handler_t handler);
+// run `e` once at `when`, replacing its previous deadline. The handler runs at the
+// next update if `when` has been reached, and may schedule `e` again for later.
+void event_schedule(event_t *e, uint64_t when);
+void event_cancel(event_t *e);
+// may be called in signal handlers, device_update() is called at the next instruction
+void event_kick();
+// run the events which are due, called by device_update()
+void event_update();
+// the time in us until the next host event, at most `max`
+uint64_t event_host_wait(uint64_t max);
+
+#endif
@@ -0,0 +1,41 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __DEVICE_INTR_H__
+#define __DEVICE_INTR_H__
+
+#include <common.h>
+
+// the sources of the PLIC, 0 means no interrupt
+enum { IRQ_NONE, IRQ_SERIAL, IRQ_DISK, IRQ_NET, NR_IRQ };
+
+// may be called in signal handlers, the interrupts depending on the host are
+// checked again at the next instruction boundary
+void dev_raise_intr();
+// called at every instruction boundary
+void dev_intr_update();
+// drive the line of a source of the PLIC
+void dev_set_irq(int irq, bool level);
+// wfi finds no interrupt pending
+void dev_idle();
+
+#ifdef CONFIG_HAS_CLINT
+void clint_update();
+#endif
+#ifdef CONFIG_HAS_PLIC
+void plic_set_irq(int irq, bool level);
+#endif
+
+#endif
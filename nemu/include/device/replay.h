@@ -0,0 +1,39 @@
+#ifndef __DEVICE_REPLAY_H__
+#define __DEVICE_REPLAY_H__
+
+#include <common.h>
+
+enum { REPLAY_OFF, REPLAY_RECORD, REPLAY_PLAY };
+
+// sources of nondeterminism
+enum {
+  REPLAY_EV_RTC,      // value read from the RTC
+  REPLAY_EV_KEYBOARD, // value read from the keyboard controller
+  REPLAY_EV_INTR,     // interrupt injection point
+  REPLAY_EV_QUIT,     // the SDL window is closed
+  REPLAY_EV_AUDIO,    // value read from the count register of audio
+  REPLAY_EV_SERIAL,   // value read from RBR or LSR of the serial
+  REPLAY_EV_NET,      // length and content of a frame from the network
+  REPLAY_EV_NET_POLL, // the network takes the frames from the host
+  NR_REPLAY_EV
+};
+
+#ifdef CONFIG_DEVICE_REPLAY
+extern int replay_mode;
+
+void init_replay(const char *record_file, const char *replay_file);
+uint64_t replay_record(int ev, uint64_t value);
+uint64_t replay_fetch(int ev);
+void replay_async_event(int ev);
+void replay_update();
+
+// `expr` is only evaluated when not replaying, so that no host state is touched
+#define REPLAY_INPUT(ev, expr) \
+  (replay_mode == REPLAY_PLAY ? replay_fetch(ev) : replay_record(ev, (expr)))
+#define replay_playing() (replay_mode == REPLAY_PLAY)
+#else
+#define REPLAY_INPUT(ev, expr) (expr)
+#define replay_playing() false
+#endif
+
+#endif
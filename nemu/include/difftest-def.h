@@ -24,17 +24,52 @@
 enum { DIFFTEST_TO_DUT, DIFFTEST_TO_REF };
 
 #if defined(CONFIG_ISA_x86)
-# define DIFFTEST_REG_SIZE (sizeof(uint32_t) * 9) // GPRs + pc
+# define DIFFTEST_NR_REG 9 // GPRs + pc
+# define DIFFTEST_REG_SIZE (sizeof(uint32_t) * DIFFTEST_NR_REG)
 #elif defined(CONFIG_ISA_mips32)
-# define DIFFTEST_REG_SIZE (sizeof(uint32_t) * 38) // GPRs + status + lo + hi + badvaddr + cause + pc
+# define DIFFTEST_NR_REG 38 // GPRs + status + lo + hi + badvaddr + cause + pc
+# define DIFFTEST_REG_SIZE (sizeof(uint32_t) * DIFFTEST_NR_REG)
 #elif defined(CONFIG_ISA_riscv)
 #define RISCV_GPR_TYPE MUXDEF(CONFIG_RV64, uint64_t, uint32_t)
 #define RISCV_GPR_NUM  MUXDEF(CONFIG_RVE , 16, 32)
-#define DIFFTEST_REG_SIZE (sizeof(RISCV_GPR_TYPE) * (RISCV_GPR_NUM + 1)) // GPRs + pc
+#define DIFFTEST_NR_CSR 6 // mstatus, mepc, mcause, mtvec, satp, mie
+#define DIFFTEST_NR_REG (RISCV_GPR_NUM + 1 + DIFFTEST_NR_CSR) // GPRs + pc + CSRs
+#define DIFFTEST_REG_SIZE (sizeof(RISCV_GPR_TYPE) * DIFFTEST_NR_REG)
 #elif defined(CONFIG_ISA_loongarch32r)
-# define DIFFTEST_REG_SIZE (sizeof(uint32_t) * 33) // GPRs + pc
+# define DIFFTEST_NR_REG 33 // GPRs + pc
+# define DIFFTEST_REG_SIZE (sizeof(uint32_t) * DIFFTEST_NR_REG)
 #else
 # error Unsupport ISA
 #endif
 
+#ifndef DIFFTEST_NR_CSR
+# define DIFFTEST_NR_CSR 0
+#endif
+
+// The registers are transferred as an array of DIFFTEST_NR_REG words in the order
+// above. Bit i of the mask of the optional difftest_regcpy_mask() selects the i-th
+// word, so that only the registers written by the last instruction are transferred.
+// A REF without difftest_regcpy_mask() is assumed not to transfer the CSRs.
+#define DIFFTEST_REG_ALL    BITMASK(DIFFTEST_NR_REG)
+#define DIFFTEST_REG_NO_CSR BITMASK(DIFFTEST_NR_REG - DIFFTEST_NR_CSR)
+
+// The rolling hash of the results of the instructions, returned by the optional
+// difftest_exec_hash(n). For every instruction, the pmem store is folded in
+// first, then the pc, rd and the value of rd after the instruction.
+#define DIFFTEST_HASH_SEED 0xcbf29ce484222325ull
+
+static inline uint64_t difftest_hash(uint64_t h, uint64_t x) {
+  h = (h ^ x) * 0x100000001b3ull;
+  return h ^ (h >> 29);
+}
+
+static inline uint64_t difftest_hash_store(uint64_t h, uint64_t addr, int len, uint64_t data) {
+  if (len < 8) data &= (1ull << (len * 8)) - 1;
+  return difftest_hash(difftest_hash(h, addr), data);
+}
+
+static inline uint64_t difftest_hash_commit(uint64_t h, uint64_t pc, int rd, uint64_t val) {
+  return difftest_hash(difftest_hash(difftest_hash(h, pc), rd), val);
+}
+
 #endif
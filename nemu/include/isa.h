@@ -52,10 +52,20 @@ paddr_t isa_mmu_translate(vaddr_t vaddr, int len, int type);
 // interrupt/exception
 vaddr_t isa_raise_intr(word_t NO, vaddr_t epc);
 #define INTR_EMPTY ((word_t)-1)
+// isa_intr_pending() is a cheap check in isa-def.h of whether isa_query_intr()
+// may find an interrupt, so that it is not called after every instruction
 word_t isa_query_intr();
+// a device drives the interrupt pin `no` of the CPU to `level`
+void isa_set_intr_pin(int no, bool level);
 
 // difftest
 bool isa_difftest_checkregs(CPU_state *ref_r, vaddr_t pc);
 void isa_difftest_attach();
+// index of the register possibly written by the instruction, in the words transferred by regcpy
+int isa_difftest_commit_reg(struct Decode *s);
+// the registers written by the instruction, as a mask of the words transferred by regcpy
+uint64_t isa_difftest_dirty_mask(struct Decode *s);
+// name of a word transferred by regcpy
+const char *isa_difftest_reg_name(int idx);
 
 #endif
@@ -0,0 +1,34 @@
+#ifndef __MTRACE_DEF_H__
+#define __MTRACE_DEF_H__
+
+#include <stdint.h>
+
+/*
+Binary format of the memory access trace, shared by NEMU and tools/mtrace-analyzer.
+The file is a mtrace_header followed by mtrace_rec until EOF, in host byte order.
+*/
+
+#define MTRACE_MAGIC "NEMUMTR1"
+
+typedef struct {
+  char magic[8];
+  uint32_t rec_size; // sizeof(mtrace_rec)
+  uint32_t word_size; // sizeof(word_t) of the guest
+  uint64_t mbase, msize;
+} mtrace_header;
+
+// the same values as MEM_TYPE_* in isa.h
+enum { MTRACE_IFETCH, MTRACE_READ, MTRACE_WRITE };
+enum { MTRACE_PMEM, MTRACE_MMIO };
+
+typedef struct {
+  uint64_t pc;
+  uint64_t addr;
+  uint64_t data;
+  uint8_t len;
+  uint8_t type;   // MTRACE_IFETCH, MTRACE_READ or MTRACE_WRITE
+  uint8_t region; // MTRACE_PMEM or MTRACE_MMIO
+  uint8_t pad[5];
+} mtrace_rec;
+
+#endif
@@ -1,3 +1,6 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
 #include <cpu/decode.h>
 
 // store instruction log information to s->logbuf
@@ -14,8 +17,60 @@ typedef struct func_info_
     word_t begin_addr, end_addr;
 }func_info;
 
-void ftrace_call(word_t pc, word_t dnpc);
+// rd is the link register of the jump, rd == 0 means a tail call.
+void ftrace_call(word_t pc, word_t dnpc, int rd);
 
 void ftrace_ret(word_t pc, word_t dnpc);
 
+// write the calling-context profile, see CONFIG_FTRACE_PROFILE
+void ftrace_profile_dump();
+
+// write the buffered binary memory trace records, see src/utils/mtrace.c
+void mtrace_flush();
+
+
+
+// trace condition, see src/utils/trace_cond.c
+#include <memory/paddr.h>
+
+#define TCOND_PC_SHIFT MUXDEF(CONFIG_ISA_x86, 0, 2) // granularity of the pc bitmap
+
+typedef struct
+{
+    bool enable;           // false: every instruction is traced
+    uint8_t *pc_bitmap;    // one bit per instruction slot in pmem, NULL: no pc filter
+    bool has_class;        // filter by instruction class
+    bool class_ok[128];    // indexed by the major opcode
+    uint64_t inst_start;   // window of g_nr_guest_inst, [inst_start, inst_end)
+    uint64_t inst_end;
+} trace_cond_t;
+
+extern trace_cond_t trace_cond;
+
+bool trace_cond_parse(char *spec);
+void trace_cond_display();
+
+// the condition is compiled into trace_cond, checking it is O(1)
+static inline bool trace_cond_check(Decode *s)
+{
+    extern uint64_t g_nr_guest_inst;
+    if (likely(!trace_cond.enable))
+        return true;
+    if (g_nr_guest_inst < trace_cond.inst_start || g_nr_guest_inst >= trace_cond.inst_end)
+        return false;
+    if (trace_cond.pc_bitmap)
+    {
+        if (!in_pmem(s->pc))
+            return false;
+        paddr_t slot = (s->pc - CONFIG_MBASE) >> TCOND_PC_SHIFT;
+        if (!(trace_cond.pc_bitmap[slot >> 3] & (1 << (slot & 7))))
+            return false;
+    }
+#ifdef CONFIG_ISA_riscv
+    if (trace_cond.has_class && !trace_cond.class_ok[BITS(s->isa.inst.val, 6, 0)])
+        return false;
+#endif
+    return true;
+}
 
+#endif
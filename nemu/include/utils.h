@@ -78,19 +78,6 @@ uint64_t get_time();
   } while (0) \
 )
 
-#ifdef CONFIG_MTRACE
-#define mlog_write(...) IFDEF(CONFIG_TARGET_NATIVE_ELF, \
-  do { \
-    extern FILE* log_mfp; \
-    extern bool log_enable(); \
-    if (log_enable()) { \
-      fprintf(log_mfp, __VA_ARGS__); \
-      fflush(log_mfp); \
-    } \
-  } while (0) \
-)
-#endif
-
 #ifdef CONFIG_FTRACE
 #define flog_write(...) IFDEF(CONFIG_TARGET_NATIVE_ELF, \
   do { \
@@ -117,12 +104,6 @@ uint64_t get_time();
     ilog_write(__VA_ARGS__); \
   } while (0)
 
-  #define _MLog(...) \
-  do { \
-    printf(__VA_ARGS__); \
-    mlog_write(__VA_ARGS__); \
-  } while (0)
-
   #define _FLog(...) \
   do { \
     printf(__VA_ARGS__); \
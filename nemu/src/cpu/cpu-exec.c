@@ -19,6 +19,9 @@
 #include <locale.h>
 #include <trace.h>
 #include <sdb/watchpoint.h>
+#ifdef CONFIG_DEVICE
+#include <device/event.h>
+#endif
 
 /* The assembly code of instructions executed is only output to the screen
  * when the number of instructions executed is less than this value.
@@ -33,26 +36,40 @@ uint64_t g_nr_guest_inst = 0; // total guest instructions
 static uint64_t g_timer = 0;  // unit: us
 
 void device_update();
+void serial_flush();
 
 static void trace_and_difftest(Decode *_this, vaddr_t dnpc)
 {
 #ifdef CONFIG_ITRACE
-  store_inst2logbuf(_this);
-#endif
+  // disassembling is the most expensive part of itrace, skip it if the instruction is not traced
+  bool itrace_on = ((ITRACE_COND) && trace_cond_check(_this)) ||
+                   MUXDEF(CONFIG_DIFFTEST_REPORT_TRACE, difftest_trace_window, false);
+  if (itrace_on || g_print_step)
+  {
+    store_inst2logbuf(_this);
+  }
 
+  if (itrace_on)
+  {
 #ifdef CONFIG_ITRACE_IRINGBUF
-  irb_add(_this->logbuf);
+    irb_add(_this->logbuf);
 
 #else // enabling IRINGBUF will disable the normal functioning of ITRACE(not every instruction will be logged, only the most recent CONFIG_IRINGBUF_SIZE will be logged.)
-  // printf("%s\n",_this->logbuf);
-  log_write("%s\n", _this->logbuf);
+    // printf("%s\n",_this->logbuf);
+    log_write("%s\n", _this->logbuf);
+#endif
+  }
 #endif
 
   if (g_print_step) // g_print_step is true only when using si CNT and CNT is less than MAX_INST_TO_PRINT.
   {
     IFDEF(CONFIG_ITRACE, puts(_this->logbuf));
   }
-  IFDEF(CONFIG_DIFFTEST, difftest_step(_this->pc, dnpc));
+#ifdef CONFIG_DIFFTEST_PIPELINE
+  difftest_pipe_commit(_this);
+#else
+  IFDEF(CONFIG_DIFFTEST, difftest_step(_this, dnpc));
+#endif
 
   IFDEF(CONFIG_WATCHPOINT, watchpoints_check());
 }
@@ -99,6 +116,15 @@ static void exec_once(Decode *s, vaddr_t pc)
   */
 }
 
+// an interrupt is possibly pending after the instruction
+static void take_intr()
+{
+  word_t intr = isa_query_intr();
+  if (intr == INTR_EMPTY)
+    return;
+  MUXDEF(CONFIG_DIFFTEST, difftest_intr(intr), cpu.pc = isa_raise_intr(intr, cpu.pc));
+}
+
 static void execute(uint64_t n)
 {
   Decode s;
@@ -109,7 +135,9 @@ static void execute(uint64_t n)
     trace_and_difftest(&s, cpu.pc);
     if (nemu_state.state != NEMU_RUNNING)
       break;
-    IFDEF(CONFIG_DEVICE, device_update());
+    IFDEF(CONFIG_DEVICE, if (unlikely(event_due())) device_update());
+    if (unlikely(isa_intr_pending()))
+      take_intr();
   }
 }
 
@@ -129,6 +157,7 @@ void assert_fail_msg()
 {
   isa_reg_display();
   statistic();
+  IFDEF(CONFIG_MTRACE, mtrace_flush());
 }
 
 /*
@@ -152,6 +181,11 @@ void cpu_exec(uint64_t n)
   uint64_t timer_start = get_time();
 
   execute(n);
+  IFDEF(CONFIG_MTRACE, mtrace_flush());
+  // the output of the guest comes before the messages of NEMU
+  IFDEF(CONFIG_HAS_SERIAL, IFNDEF(CONFIG_TARGET_AM, serial_flush()));
+  // wait for REF to check the rest of the instructions
+  IFDEF(CONFIG_DIFFTEST_PIPELINE, difftest_pipe_sync());
 
   uint64_t timer_end = get_time();
   g_timer += timer_end - timer_start;
@@ -170,5 +204,6 @@ void cpu_exec(uint64_t n)
     // fall through
   case NEMU_QUIT:
     statistic();
+    IFDEF(CONFIG_FTRACE_PROFILE, ftrace_profile_dump());
   }
 }
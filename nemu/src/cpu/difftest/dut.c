@@ -17,7 +17,10 @@
 
 #include <isa.h>
 #include <cpu/cpu.h>
+#include <cpu/decode.h>
+#include <cpu/difftest.h>
 #include <memory/paddr.h>
+#include <memory/host.h>
 #include <utils.h>
 #include <difftest-def.h>
 
@@ -25,15 +28,238 @@ void (*ref_difftest_memcpy)(paddr_t addr, void *buf, size_t n, bool direction) =
 void (*ref_difftest_regcpy)(void *dut, bool direction) = NULL;
 void (*ref_difftest_exec)(uint64_t n) = NULL;
 void (*ref_difftest_raise_intr)(uint64_t NO) = NULL;
+void (*ref_difftest_mmio_load)(paddr_t addr, int len, word_t data) = NULL;
+void (*ref_difftest_regcpy_mask)(void *dut, uint64_t mask, bool direction) = NULL;
+void (*ref_difftest_exec_trace)(const uint64_t *pc, uint64_t n) = NULL;
+uint64_t (*ref_difftest_exec_hash)(uint64_t n) = NULL;
+bool (*ref_difftest_share_mem)(void *dut_pmem, paddr_t base, size_t size) = NULL;
+int (*ref_difftest_shared_store)(paddr_t *addr, word_t *data) = NULL;
 
 #ifdef CONFIG_DIFFTEST
 
 static bool is_skip_ref = false;
+static bool is_mmio = false; // REF has caught up with DUT before a device access
 static int skip_dut_nr_inst = 0;
 
+static uint64_t ref_regs = DIFFTEST_REG_NO_CSR; // the registers transferred by REF
+
+// the diverging batch is being re-run with full tracing, see DIFFTEST_REPORT_TRACE
+bool difftest_trace_window = false;
+
+// the registers which REF does not transfer are taken from `dut`
+void difftest_get_ref_regs(void *ref_r, const void *dut) {
+  ref_difftest_regcpy(ref_r, DIFFTEST_TO_DUT);
+  for (uint64_t m = DIFFTEST_REG_ALL & ~ref_regs; m != 0; m &= m - 1) {
+    int i = __builtin_ctzll(m);
+    ((word_t *)ref_r)[i] = ((const word_t *)dut)[i];
+  }
+}
+
+// REF uses the memory of DUT, see DIFFTEST_SHARE_MEM
+static bool mem_shared = false;
+static struct {
+  paddr_t addr;
+  int len;
+  word_t data;
+} dut_store = {};
+
+static void checkregs(CPU_state *ref, vaddr_t pc) {
+  if (!isa_difftest_checkregs(ref, pc)) {
+    nemu_state.state = NEMU_ABORT;
+    nemu_state.halt_pc = pc;
+    difftest_report(ref, pc);
+  }
+}
+
+// compare only the registers written by the instruction
+static bool dirty_regs_agree(uint64_t mask) {
+  word_t ref_w[DIFFTEST_NR_REG];
+  ref_difftest_regcpy_mask(ref_w, mask, DIFFTEST_TO_DUT);
+  for (; mask != 0; mask &= mask - 1) {
+    int i = __builtin_ctzll(mask);
+    if (ref_w[i] != ((word_t *)&cpu)[i]) return false;
+  }
+  return true;
+}
+
+// let REF execute the instruction of DUT, then check whether they agree
+static void exec_and_check(Decode *s) {
+  CPU_state ref_r;
+  ref_difftest_exec(1);
+  if (ref_difftest_regcpy_mask != NULL && dirty_regs_agree(isa_difftest_dirty_mask(s))) return;
+  difftest_get_ref_regs(&ref_r, &cpu);
+  checkregs(&ref_r, s->pc);
+}
+
+// REF does not write the shared memory, but reports its store
+static void check_store(vaddr_t pc) {
+  paddr_t addr = 0;
+  word_t data = 0;
+  int len = ref_difftest_shared_store(&addr, &data);
+  if (len != dut_store.len || (len > 0 && (addr != dut_store.addr || data != dut_store.data))) {
+    Log("the store is different after executing instruction at pc = " FMT_WORD
+        ", right = " FMT_PADDR "/%d/" FMT_WORD ", wrong = " FMT_PADDR "/%d/" FMT_WORD,
+        pc, addr, len, data, dut_store.addr, dut_store.len, dut_store.data);
+    nemu_state.state = NEMU_ABORT;
+    nemu_state.halt_pc = pc;
+    CPU_state ref_r;
+    difftest_get_ref_regs(&ref_r, &cpu);
+    difftest_report(&ref_r, pc);
+  }
+  dut_store.len = 0;
+}
+
+/*
+Batched difftest: DUT and REF run CONFIG_DIFFTEST_BATCH instructions between two
+comparisons. `snap` is the last state where they agree. The stores of DUT since then
+are logged, so that on a mismatch DUT can roll back to `snap`, REF gets the state of
+DUT, and the batch is re-run with a comparison after every instruction.
+*/
+#define BATCH CONFIG_DIFFTEST_BATCH
+
+extern uint64_t g_nr_guest_inst;
+
+static CPU_state snap;
+static uint64_t batch_nr = 0;  // instructions executed by DUT since `snap`
+static uint64_t bisect_nr = 0; // instructions to check one by one after a rollback
+static bool batch_diverged = false;
+// pcs of the instructions in this batch, for REFs which can run to a breakpoint
+static uint64_t batch_pc[BATCH + 1];
+static uint64_t batch_hash = DIFFTEST_HASH_SEED;
+
+typedef struct {
+  paddr_t addr;
+  int len;
+  word_t data;
+} undo_rec;
+
+static undo_rec *undo_log = NULL;
+static int undo_nr = 0, undo_size = 0;
+
+void difftest_log_store(paddr_t addr, int len, word_t data) {
+#ifdef CONFIG_DIFFTEST_PIPELINE
+  difftest_pipe_store(addr, len, data);
+  return;
+#endif
+  if (mem_shared) {
+    dut_store.addr = addr;
+    dut_store.len = len;
+    dut_store.data = len >= sizeof(word_t) ? data : data & BITMASK(len * 8);
+    return;
+  }
+  if (BATCH == 1 || bisect_nr > 0) return;
+  IFDEF(CONFIG_DIFFTEST_HASH, batch_hash = difftest_hash_store(batch_hash, addr, len, data));
+  if (undo_nr == undo_size) {
+    undo_size = undo_size ? undo_size * 2 : 1024;
+    undo_log = realloc(undo_log, sizeof(undo_rec) * undo_size);
+    assert(undo_log);
+  }
+  undo_log[undo_nr ++] = (undo_rec) { addr, len, host_read(guest_to_host(addr), len) };
+}
+
+static void batch_snapshot() {
+  snap = cpu;
+  batch_nr = 0;
+  undo_nr = 0;
+  batch_hash = DIFFTEST_HASH_SEED;
+}
+
+// `n` instructions from the start of the batch, ending at cpu.pc
+static void batch_exec(uint64_t n) {
+  if (ref_difftest_exec_trace == NULL) {
+    ref_difftest_exec(n);
+    return;
+  }
+  batch_pc[n] = cpu.pc;
+  ref_difftest_exec_trace(batch_pc, n);
+}
+
+// let REF execute the instructions of DUT in this batch, then check whether they agree
+static bool batch_sync(uint64_t n) {
+  CPU_state ref_r;
+#ifdef CONFIG_DIFFTEST_HASH
+  if (ref_difftest_exec_hash != NULL) return ref_difftest_exec_hash(n) == batch_hash;
+#endif
+  batch_exec(n);
+  difftest_get_ref_regs(&ref_r, &cpu);
+  return memcmp(&ref_r, &cpu, DIFFTEST_REG_SIZE) == 0;
+}
+
+static void batch_rollback() {
+  Log("DUT and REF diverge within %" PRIu64 " instructions from pc = " FMT_WORD
+      ", roll back and check them one by one", batch_nr, snap.pc);
+  for (int i = undo_nr - 1; i >= 0; i --) {
+    host_write(guest_to_host(undo_log[i].addr), undo_log[i].len, undo_log[i].data);
+  }
+  cpu = snap;
+  g_nr_guest_inst -= batch_nr;
+  IFDEF(CONFIG_IQUEUE, iqueue_rewind(batch_nr));
+#ifdef CONFIG_DIFFTEST_REPORT_TRACE
+  Log("The itrace and mtrace of these instructions are written to the log");
+  difftest_trace_window = true;
+#endif
+  ref_difftest_memcpy(CONFIG_MBASE, guest_to_host(CONFIG_MBASE), CONFIG_MSIZE, DIFFTEST_TO_REF);
+  ref_difftest_regcpy(&cpu, DIFFTEST_TO_REF);
+  // the batch may end with the trap instruction
+  nemu_state.state = NEMU_RUNNING;
+  bisect_nr = batch_nr;
+  batch_nr = 0;
+  undo_nr = 0;
+  batch_diverged = false;
+}
+
+// An instruction accessing a device ends the batch: REF catches up with DUT before
+// it, since DUT can not roll back the side effect of the access. This is called in the middle of the
+// instruction, before it writes any register, so the state of DUT is the one after
+// the previous instruction.
+static void batch_cut() {
+  if (BATCH > 1 && bisect_nr == 0 && skip_dut_nr_inst == 0 && !is_skip_ref && !is_mmio) {
+    batch_diverged = !batch_sync(batch_nr);
+  }
+}
+
+static void batch_step(Decode *s) {
+  batch_pc[batch_nr ++] = s->pc;
+  if (is_skip_ref) {
+    // REF has executed the instructions before this one in difftest_skip_ref()
+    is_skip_ref = false;
+    is_mmio = false;
+    if (batch_diverged) {
+      batch_rollback();
+      return;
+    }
+    ref_difftest_regcpy(&cpu, DIFFTEST_TO_REF);
+    batch_snapshot();
+    return;
+  }
+  if (is_mmio) {
+    // REF has executed the instructions before this one in difftest_mmio()
+    is_mmio = false;
+    if (batch_diverged) {
+      batch_rollback();
+      return;
+    }
+    exec_and_check(s);
+    batch_snapshot();
+    return;
+  }
+#ifdef CONFIG_DIFFTEST_HASH
+  int rd = isa_difftest_commit_reg(s);
+  batch_hash = difftest_hash_commit(batch_hash, s->pc, rd, ((word_t *)&cpu)[rd]);
+#endif
+  if (batch_nr < BATCH && nemu_state.state == NEMU_RUNNING) return;
+  if (batch_sync(batch_nr)) batch_snapshot();
+  else batch_rollback();
+}
+
 // this is used to let ref skip instructions which
 // can not produce consistent behavior with NEMU
 void difftest_skip_ref() {
+#ifdef CONFIG_DIFFTEST_PIPELINE
+  difftest_pipe_skip_ref();
+  return;
+#endif
+  batch_cut();
   is_skip_ref = true;
   // If such an instruction is one of the instruction packing in QEMU
   // (see below), we end the process of catching up with QEMU's pc to
@@ -45,6 +271,60 @@ void difftest_skip_ref() {
   skip_dut_nr_inst = 0;
 }
 
+// This is called after DUT accesses a device. If REF can take the value loaded
+// by DUT, the instruction is still checked, instead of copying the whole state
+// of DUT into REF. REF drops its stores to devices. A store ends the batch as
+// well, so that it is not done again if the batch is rolled back.
+void difftest_mmio(paddr_t addr, int len, word_t data, bool is_write) {
+  if (ref_difftest_mmio_load == NULL) {
+    difftest_skip_ref();
+    return;
+  }
+#ifdef CONFIG_DIFFTEST_PIPELINE
+  if (!is_write) difftest_pipe_mmio_load(addr, len, data);
+  return;
+#endif
+  batch_cut();
+  is_mmio = true;
+  if (!is_write) ref_difftest_mmio_load(addr, len, data);
+}
+
+// This is called after a device writes `len` bytes into pmem at `addr`, in the
+// middle of the instruction accessing the device. REF catches up with DUT before
+// that instruction, then takes the new data and the state of DUT after it.
+void difftest_dma(paddr_t addr, size_t len) {
+  IFDEF(CONFIG_DIFFTEST_PIPELINE, difftest_pipe_sync());
+  difftest_skip_ref();
+  if (!mem_shared) ref_difftest_memcpy(addr, guest_to_host(addr), len, DIFFTEST_TO_REF);
+}
+
+// DUT takes the interrupt `NO` between two instructions, and REF takes it at the
+// same point. In a batch, REF catches up with DUT first. If they diverge, DUT rolls
+// back instead, and the interrupt is taken in the re-run, since it is still pending.
+void difftest_intr(word_t NO) {
+#ifdef CONFIG_DIFFTEST_PIPELINE
+  difftest_pipe_sync();
+  if (nemu_state.state == NEMU_ABORT) return;
+  ref_difftest_regcpy(&cpu, DIFFTEST_TO_REF);
+  cpu.pc = isa_raise_intr(NO, cpu.pc);
+  ref_difftest_raise_intr(NO);
+  difftest_pipe_intr();
+  return;
+#endif
+  if (BATCH > 1 && bisect_nr == 0 && skip_dut_nr_inst == 0 && batch_nr > 0 && !batch_sync(batch_nr)) {
+    batch_rollback();
+    return;
+  }
+  // isa_query_intr() may move DUT past wfi
+  ref_difftest_regcpy(&cpu, DIFFTEST_TO_REF);
+  cpu.pc = isa_raise_intr(NO, cpu.pc);
+  ref_difftest_raise_intr(NO);
+  CPU_state ref_r;
+  difftest_get_ref_regs(&ref_r, &cpu);
+  checkregs(&ref_r, cpu.pc);
+  if (BATCH > 1 && skip_dut_nr_inst == 0) batch_snapshot();
+}
+
 // this is used to deal with instruction packing in QEMU.
 // Sometimes letting QEMU step once will execute multiple instructions.
 // We should skip checking until NEMU's pc catches up with QEMU's pc.
@@ -52,6 +332,13 @@ void difftest_skip_ref() {
 //   Let REF run `nr_ref` instructions first.
 //   We expect that DUT will catch up with REF within `nr_dut` instructions.
 void difftest_skip_dut(int nr_ref, int nr_dut) {
+  if (BATCH > 1 && bisect_nr == 0 && skip_dut_nr_inst == 0) {
+    // the rest of the batch is checked when DUT catches up with REF
+    batch_exec(batch_nr);
+    batch_nr = 0;
+    undo_nr = 0;
+    batch_hash = DIFFTEST_HASH_SEED;
+  }
   skip_dut_nr_inst += nr_dut;
 
   while (nr_ref -- > 0) {
@@ -78,6 +365,23 @@ void init_difftest(char *ref_so_file, long img_size, int port) {
   ref_difftest_raise_intr = dlsym(handle, "difftest_raise_intr");
   assert(ref_difftest_raise_intr);
 
+  // optional, see difftest_mmio()
+  ref_difftest_mmio_load = dlsym(handle, "difftest_mmio_load");
+
+  // optional, only the registers written by an instruction are transferred and compared
+  ref_difftest_regcpy_mask = dlsym(handle, "difftest_regcpy_mask");
+  if (ref_difftest_regcpy_mask != NULL) ref_regs = DIFFTEST_REG_ALL;
+
+  // optional, runs a batch by following the pcs of DUT
+  ref_difftest_exec_trace = dlsym(handle, "difftest_exec_trace");
+
+  // optional, see DIFFTEST_HASH
+  ref_difftest_exec_hash = dlsym(handle, "difftest_exec_hash");
+
+  // optional, see DIFFTEST_SHARE_MEM
+  ref_difftest_share_mem = dlsym(handle, "difftest_share_mem");
+  ref_difftest_shared_store = dlsym(handle, "difftest_shared_store");
+
   void (*ref_difftest_init)(int) = dlsym(handle, "difftest_init");
   assert(ref_difftest_init);
 
@@ -87,23 +391,34 @@ void init_difftest(char *ref_so_file, long img_size, int port) {
       "If it is not necessary, you can turn it off in menuconfig.", ref_so_file);
 
   ref_difftest_init(port);
-  ref_difftest_memcpy(RESET_VECTOR, guest_to_host(RESET_VECTOR), img_size, DIFFTEST_TO_REF);
+#ifdef CONFIG_DIFFTEST_SHARE_MEM
+  if (BATCH > 1) Log("REF can not use the memory of DUT when DIFFTEST_BATCH > 1");
+  else if (ref_difftest_share_mem != NULL && ref_difftest_shared_store != NULL) {
+    mem_shared = ref_difftest_share_mem(guest_to_host(CONFIG_MBASE), CONFIG_MBASE, CONFIG_MSIZE);
+  }
+#endif
+  if (mem_shared) Log("REF uses the memory of DUT, the image is not copied");
+  else ref_difftest_memcpy(RESET_VECTOR, guest_to_host(RESET_VECTOR), img_size, DIFFTEST_TO_REF);
   ref_difftest_regcpy(&cpu, DIFFTEST_TO_REF);
-}
-
-static void checkregs(CPU_state *ref, vaddr_t pc) {
-  if (!isa_difftest_checkregs(ref, pc)) {
-    nemu_state.state = NEMU_ABORT;
-    nemu_state.halt_pc = pc;
-    isa_reg_display();
+#ifdef CONFIG_DIFFTEST_PIPELINE
+  difftest_pipe_init();
+  return;
+#endif
+  if (BATCH > 1) {
+    Log("Compare with REF every %d instructions%s", BATCH,
+        ISDEF(CONFIG_DIFFTEST_HASH) && ref_difftest_exec_hash != NULL ? " by a hash of the results" : "");
+    batch_snapshot();
   }
 }
 
-void difftest_step(vaddr_t pc, vaddr_t npc) {
+static void difftest_step_one(Decode *s, vaddr_t npc) {
   CPU_state ref_r;
+  vaddr_t pc = s->pc;
+
+  is_mmio = false;
 
   if (skip_dut_nr_inst > 0) {
-    ref_difftest_regcpy(&ref_r, DIFFTEST_TO_DUT);
+    difftest_get_ref_regs(&ref_r, &cpu);
     if (ref_r.pc == npc) {
       skip_dut_nr_inst = 0;
       checkregs(&ref_r, npc);
@@ -119,13 +434,28 @@ void difftest_step(vaddr_t pc, vaddr_t npc) {
     // to skip the checking of an instruction, just copy the reg state to reference design
     ref_difftest_regcpy(&cpu, DIFFTEST_TO_REF);
     is_skip_ref = false;
+    dut_store.len = 0;
     return;
   }
 
-  ref_difftest_exec(1);
-  ref_difftest_regcpy(&ref_r, DIFFTEST_TO_DUT);
+  exec_and_check(s);
+  if (mem_shared) check_store(pc);
+}
 
-  checkregs(&ref_r, pc);
+void difftest_step(Decode *s, vaddr_t npc) {
+  IFDEF(CONFIG_IQUEUE, iqueue_commit(s));
+  if (BATCH > 1 && bisect_nr == 0 && skip_dut_nr_inst == 0) {
+    batch_step(s);
+    return;
+  }
+  difftest_step_one(s, npc);
+  if (BATCH > 1) {
+    if (bisect_nr > 0 && -- bisect_nr == 0 && nemu_state.state != NEMU_ABORT) {
+      Log("No divergence is found when checking the instructions one by one");
+    }
+    if (bisect_nr == 0) difftest_trace_window = false;
+    if (skip_dut_nr_inst == 0) batch_snapshot();
+  }
 }
 #else
 void init_difftest(char *ref_so_file, long img_size, int port) { }
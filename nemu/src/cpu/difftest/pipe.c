@@ -0,0 +1,209 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <isa.h>
+#include <cpu/cpu.h>
+#include <cpu/decode.h>
+#include <cpu/difftest.h>
+#include <memory/paddr.h>
+
+#ifdef CONFIG_DIFFTEST_PIPELINE
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sched.h>
+
+/*
+Pipelined difftest: DUT pushes a commit record of every instruction into a
+single-producer single-consumer queue, and REF runs on another thread to verify them.
+REF keeps a shadow of the registers of DUT built from the records, so DUT never
+copies its whole register file. The registers are seen as an array of words as
+transferred by regcpy, with pc before the CSRs.
+*/
+
+#define PIPE_SIZE 4096 // power of 2
+#define PIPE_PUBLISH 64 // DUT makes its records visible to REF in groups
+#define NR_REG_WORD DIFFTEST_NR_REG
+#define PC_IDX (DIFFTEST_NR_REG - DIFFTEST_NR_CSR - 1)
+#define CSR_MASK (DIFFTEST_REG_ALL & ~DIFFTEST_REG_NO_CSR)
+
+typedef struct {
+  uint64_t seq; // value of g_nr_guest_inst
+  vaddr_t pc, npc;
+  int reg;      // index of the register possibly written
+  word_t reg_val;
+  paddr_t mem_addr;
+  int mem_len;  // 0 if the instruction does not write pmem
+  word_t mem_data;
+  paddr_t load_addr;
+  int load_len; // 0 if the instruction does not load from a device
+  word_t load_data;
+  bool csr;     // the CSRs are written
+  word_t csr_val[DIFFTEST_NR_CSR];
+  bool skip;    // accesses a device, REF only takes the result
+} commit_rec;
+
+static commit_rec pipe[PIPE_SIZE];
+static uint64_t dut_head = 0; // private to DUT
+static _Atomic uint64_t pipe_head = 0, pipe_tail = 0;
+static _Atomic bool pipe_error = false;
+
+// written by REF before setting `pipe_error`
+static commit_rec err_rec;
+static word_t err_ref[NR_REG_WORD], err_dut[NR_REG_WORD];
+static word_t err_ref_mem;
+static bool err_is_mem;
+
+// the registers given to REF, taken before DUT runs
+static word_t init_regs[NR_REG_WORD];
+
+static commit_rec cur = {};
+static bool intr_taken = false; // the CSRs are written by an interrupt after the last record
+
+extern uint64_t g_nr_guest_inst;
+
+static void report_error(commit_rec *r, word_t *ref, word_t *dut, bool is_mem, word_t ref_mem) {
+  err_rec = *r;
+  memcpy(err_ref, ref, sizeof(err_ref));
+  memcpy(err_dut, dut, sizeof(err_dut));
+  err_is_mem = is_mem;
+  err_ref_mem = ref_mem;
+  atomic_store_explicit(&pipe_error, true, memory_order_release);
+}
+
+static void *ref_thread(void *arg) {
+  word_t shadow[NR_REG_WORD], ref_r[NR_REG_WORD];
+  memcpy(shadow, init_regs, sizeof(shadow));
+  uint64_t tail = 0;
+  while (true) {
+    uint64_t head = atomic_load_explicit(&pipe_head, memory_order_acquire);
+    if (tail == head) {
+      sched_yield();
+      continue;
+    }
+    for (; tail != head; tail ++) {
+      commit_rec *r = &pipe[tail & (PIPE_SIZE - 1)];
+      shadow[r->reg] = r->reg_val;
+      shadow[PC_IDX] = r->npc;
+      if (r->csr) memcpy(shadow + PC_IDX + 1, r->csr_val, sizeof(r->csr_val));
+      if (r->skip) {
+        ref_difftest_regcpy(shadow, DIFFTEST_TO_REF);
+        continue;
+      }
+      if (r->load_len > 0) ref_difftest_mmio_load(r->load_addr, r->load_len, r->load_data);
+      ref_difftest_exec(1);
+      difftest_get_ref_regs(ref_r, shadow);
+      if (memcmp(ref_r, shadow, sizeof(shadow)) != 0) {
+        report_error(r, ref_r, shadow, false, 0);
+        return NULL;
+      }
+      if (r->mem_len > 0) {
+        word_t data = 0;
+        ref_difftest_memcpy(r->mem_addr, &data, r->mem_len, DIFFTEST_TO_DUT);
+        if (data != r->mem_data) {
+          report_error(r, ref_r, shadow, true, data);
+          return NULL;
+        }
+      }
+    }
+    atomic_store_explicit(&pipe_tail, tail, memory_order_release);
+  }
+  return NULL;
+}
+
+// DUT takes the state after the wrong instruction, so that it can be examined in sdb
+static void handle_error() {
+  Log("REF finds a mismatch at the %" PRIu64 "-th instruction, pc = " FMT_WORD,
+      err_rec.seq, err_rec.pc);
+  if (err_is_mem) {
+    Log("memory at " FMT_PADDR " is different, right = " FMT_WORD ", wrong = " FMT_WORD,
+        err_rec.mem_addr, err_ref_mem, err_rec.mem_data);
+  }
+  memcpy(&cpu, err_dut, sizeof(err_dut));
+  if (!isa_difftest_checkregs((CPU_state *)err_ref, err_rec.pc) || err_is_mem) {
+    difftest_report(err_ref, err_rec.pc);
+  }
+  nemu_state.state = NEMU_ABORT;
+  nemu_state.halt_pc = err_rec.pc;
+}
+
+static void publish() {
+  atomic_store_explicit(&pipe_head, dut_head, memory_order_release);
+  if (unlikely(atomic_load_explicit(&pipe_error, memory_order_acquire)) && nemu_state.state != NEMU_ABORT) {
+    handle_error();
+  }
+}
+
+void difftest_pipe_commit(Decode *s) {
+  while (dut_head - atomic_load_explicit(&pipe_tail, memory_order_acquire) == PIPE_SIZE) {
+    publish();
+    if (nemu_state.state == NEMU_ABORT) return;
+    sched_yield();
+  }
+  cur.seq = g_nr_guest_inst;
+  cur.pc = s->pc;
+  cur.npc = cpu.pc;
+  cur.reg = isa_difftest_commit_reg(s);
+  cur.reg_val = ((word_t *)&cpu)[cur.reg];
+  cur.csr = intr_taken || (isa_difftest_dirty_mask(s) & CSR_MASK) != 0;
+  intr_taken = false;
+  if (cur.csr) memcpy(cur.csr_val, (word_t *)&cpu + PC_IDX + 1, sizeof(cur.csr_val));
+  pipe[dut_head & (PIPE_SIZE - 1)] = cur;
+  cur.mem_len = 0;
+  cur.load_len = 0;
+  cur.skip = false;
+  dut_head ++;
+  if (dut_head % PIPE_PUBLISH == 0) publish();
+}
+
+void difftest_pipe_store(paddr_t addr, int len, word_t data) {
+  cur.mem_addr = addr;
+  cur.mem_len = len;
+  cur.mem_data = len >= sizeof(word_t) ? data : data & BITMASK(len * 8);
+}
+
+void difftest_pipe_mmio_load(paddr_t addr, int len, word_t data) {
+  cur.load_addr = addr;
+  cur.load_len = len;
+  cur.load_data = data;
+}
+
+void difftest_pipe_skip_ref() {
+  cur.skip = true;
+}
+
+// REF has taken the interrupt as well, the CSRs of the next record update its shadow
+void difftest_pipe_intr() {
+  intr_taken = true;
+}
+
+void difftest_pipe_sync() {
+  atomic_store_explicit(&pipe_head, dut_head, memory_order_release);
+  while (atomic_load_explicit(&pipe_tail, memory_order_acquire) != dut_head &&
+      !atomic_load_explicit(&pipe_error, memory_order_acquire)) {
+    sched_yield();
+  }
+  publish();
+}
+
+void difftest_pipe_init() {
+  // DUT may have run ahead by the time the thread starts
+  memcpy(init_regs, &cpu, sizeof(init_regs));
+  pthread_t t;
+  int ret = pthread_create(&t, NULL, ref_thread, NULL);
+  Assert(ret == 0, "Can not create the REF thread");
+  pthread_detach(t);
+  Log("REF checks the instructions on another thread");
+}
+#endif
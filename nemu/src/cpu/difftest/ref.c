@@ -15,23 +15,146 @@
 
 #include <isa.h>
 #include <cpu/cpu.h>
+#include <cpu/decode.h>
 #include <difftest-def.h>
 #include <memory/paddr.h>
 
 __EXPORT void difftest_memcpy(paddr_t addr, void *buf, size_t n, bool direction) {
-  assert(0);
+  // nothing to copy if REF uses the memory of DUT
+  if (buf == guest_to_host(addr)) return;
+  if (direction == DIFFTEST_TO_REF) memcpy(guest_to_host(addr), buf, n);
+  else memcpy(buf, guest_to_host(addr), n);
 }
 
+/*
+REF is loaded into the address space of DUT, so it can use the pmem of DUT
+instead of its own. DUT has already done the stores of an instruction when REF
+executes it, so REF does not write the memory, but records its store for DUT
+to compare with difftest_shared_store(). No instruction loads after storing,
+so the loads of REF see the same memory as the ones of DUT.
+*/
+static bool mem_shared = false;
+static struct {
+  paddr_t addr;
+  int len;
+  word_t data;
+} shared_store = {};
+
+#ifdef CONFIG_TARGET_SHARE
+__EXPORT bool difftest_share_mem(void *dut_pmem, paddr_t base, size_t size) {
+  if (base != CONFIG_MBASE || size != CONFIG_MSIZE) return false;
+  void pmem_share(uint8_t *host);
+  pmem_share(dut_pmem);
+  mem_shared = true;
+  return true;
+}
+
+// the store since the last call, with `len` = 0 if there is none
+__EXPORT int difftest_shared_store(paddr_t *addr, word_t *data) {
+  int len = shared_store.len;
+  *addr = shared_store.addr;
+  *data = shared_store.data;
+  shared_store.len = 0;
+  return len;
+}
+#endif
+
+/*
+REF has no devices. DUT passes the value of every load from a device with
+difftest_mmio_load() before REF executes the instruction, and the loads of REF
+outside pmem take them in order. Stores outside pmem are dropped.
+*/
+#define MMIO_QUEUE_SIZE 16 // power of 2
+
+static struct {
+  paddr_t addr;
+  int len;
+  word_t data;
+} mmio_queue[MMIO_QUEUE_SIZE];
+static uint32_t mmio_head = 0, mmio_tail = 0;
+
+__EXPORT void difftest_mmio_load(paddr_t addr, int len, word_t data) {
+  if (mmio_tail - mmio_head == MMIO_QUEUE_SIZE) mmio_head ++; // drop the oldest
+  int i = mmio_tail ++ % MMIO_QUEUE_SIZE;
+  mmio_queue[i].addr = addr;
+  mmio_queue[i].len = len;
+  mmio_queue[i].data = data;
+}
+
+word_t difftest_ref_mmio_read(paddr_t addr, int len) {
+  if (mmio_head == mmio_tail) return 0;
+  int i = mmio_head ++ % MMIO_QUEUE_SIZE;
+  // if REF loads from somewhere else, it has gone another way than DUT,
+  // and the comparison of the registers will report it
+  if (mmio_queue[i].addr != addr || mmio_queue[i].len != len) return 0;
+  return mmio_queue[i].data;
+}
+
+// the registers are laid out at the beginning of CPU_state in the same order as DUT
 __EXPORT void difftest_regcpy(void *dut, bool direction) {
-  assert(0);
+  if (direction == DIFFTEST_TO_REF) {
+    memcpy(&cpu, dut, DIFFTEST_REG_SIZE);
+    // the loads not taken belong to an instruction REF has skipped
+    mmio_head = mmio_tail;
+  }
+  else memcpy(dut, &cpu, DIFFTEST_REG_SIZE);
 }
 
+__EXPORT void difftest_regcpy_mask(void *dut, uint64_t mask, bool direction) {
+  word_t *ref = (word_t *)&cpu, *d = dut;
+  for (; mask != 0; mask &= mask - 1) {
+    int i = __builtin_ctzll(mask);
+    if (direction == DIFFTEST_TO_REF) ref[i] = d[i];
+    else d[i] = ref[i];
+  }
+}
+
+// REF needs no tracing, statistics or device updates, so execute the instructions
+// directly instead of going through cpu_exec()
 __EXPORT void difftest_exec(uint64_t n) {
-  assert(0);
+  Decode s;
+  for (; n > 0; n --) {
+    s.pc = cpu.pc;
+    s.snpc = cpu.pc;
+    isa_exec_once(&s);
+    cpu.pc = s.dnpc;
+  }
+}
+
+static bool hashing = false;
+static uint64_t hash;
+
+// return whether the store must not be done in pmem
+bool difftest_ref_store(paddr_t addr, int len, word_t data) {
+  if (hashing) hash = difftest_hash_store(hash, addr, len, data);
+  if (!mem_shared) return false;
+  shared_store.addr = addr;
+  shared_store.len = len;
+  shared_store.data = len >= sizeof(word_t) ? data : data & BITMASK(len * 8);
+  return true;
+}
+
+#ifdef CONFIG_ISA_riscv
+// the same as difftest_exec(), returning the hash of the results
+__EXPORT uint64_t difftest_exec_hash(uint64_t n) {
+  Decode s;
+  hash = DIFFTEST_HASH_SEED;
+  hashing = true;
+  for (; n > 0; n --) {
+    s.pc = cpu.pc;
+    s.snpc = cpu.pc;
+    isa_exec_once(&s);
+    cpu.pc = s.dnpc;
+    int rd = isa_difftest_commit_reg(&s);
+    hash = difftest_hash_commit(hash, s.pc, rd, ((word_t *)&cpu)[rd]);
+  }
+  hashing = false;
+  return hash;
 }
+#endif
 
 __EXPORT void difftest_raise_intr(word_t NO) {
-  assert(0);
+  cpu.pc = isa_raise_intr(NO, cpu.pc);
 }
 
 __EXPORT void difftest_init(int port) {
@@ -0,0 +1,78 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <isa.h>
+#include <cpu/decode.h>
+#include <cpu/difftest.h>
+
+#ifdef CONFIG_DIFFTEST
+/*
+Post-mortem of a mismatch found by difftest: the registers of REF and DUT side by
+side, then the last instructions committed by DUT. The instructions are kept in a
+ring as raw bytes and only disassembled here, so recording them is much cheaper
+than itrace, and difftest can run with tracing off.
+*/
+#ifdef CONFIG_IQUEUE
+typedef struct {
+  uint64_t seq; // the index of the instruction in the ring
+  vaddr_t pc;
+  uint32_t inst;
+  int ilen;
+} iqueue_rec;
+
+static iqueue_rec iqueue[CONFIG_IQUEUE_SIZE];
+static uint64_t iqueue_nr = 0;
+
+void iqueue_commit(Decode *s) {
+  iqueue_rec *r = &iqueue[iqueue_nr % CONFIG_IQUEUE_SIZE];
+  r->seq = iqueue_nr ++;
+  r->pc = s->pc;
+  r->inst = s->isa.inst.val;
+  r->ilen = s->snpc - s->pc;
+}
+
+// the last `n` instructions are executed again after a rollback
+void iqueue_rewind(uint64_t n) {
+  iqueue_nr -= n < iqueue_nr ? n : iqueue_nr;
+}
+
+static void iqueue_dump(vaddr_t pc) {
+  uint64_t n = iqueue_nr < CONFIG_IQUEUE_SIZE ? iqueue_nr : CONFIG_IQUEUE_SIZE;
+  _Log("The last %" PRIu64 " instructions committed by DUT:\n", n);
+  for (uint64_t i = iqueue_nr - n; i < iqueue_nr; i ++) {
+    iqueue_rec *r = &iqueue[i % CONFIG_IQUEUE_SIZE];
+    // the entries after a rollback point may be lost
+    if (r->seq != i) continue;
+    char asm_buf[96] = "";
+#ifndef CONFIG_ISA_loongarch32r
+    void disassemble(char *str, int size, uint64_t pc, uint8_t *code, int nbyte);
+    disassemble(asm_buf, sizeof(asm_buf), r->pc, (uint8_t *)&r->inst, r->ilen);
+#endif
+    _Log("%s " FMT_WORD ": %08x  %s\n", (r->pc == pc && i == iqueue_nr - 1) ? "-->" : "   ",
+        r->pc, r->inst, asm_buf);
+  }
+}
+#endif
+
+void difftest_report(const void *ref, vaddr_t pc) {
+  const word_t *r = ref, *d = (const word_t *)&cpu;
+  _Log("%-10s %-*s %s\n", "", (int)sizeof(word_t) * 2 + 2, "REF", "DUT");
+  for (int i = 0; i < DIFFTEST_NR_REG; i ++) {
+    _Log("%-10s " FMT_WORD " " FMT_WORD "%s\n", isa_difftest_reg_name(i), r[i], d[i],
+        r[i] != d[i] ? "  <--" : "");
+  }
+  IFDEF(CONFIG_IQUEUE, iqueue_dump(pc));
+}
+#endif
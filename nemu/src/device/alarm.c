@@ -15,6 +15,7 @@
 
 #include <common.h>
 #include <device/alarm.h>
+#include <device/event.h>
 #include <sys/time.h>
 #include <signal.h>
 
@@ -35,7 +36,23 @@ static void alarm_sig_handler(int signum) {
   }
 }
 
+#ifdef CONFIG_TIMER_ICOUNT
+static event_t alarm_ev;
+
+// the alarm fires at exact instruction counts
+static void alarm_icount_fire() {
+  event_schedule(&alarm_ev, alarm_ev.when + ICOUNT_PER_ALARM);
+  alarm_sig_handler(0);
+}
+#endif
+
 void init_alarm() {
+#ifdef CONFIG_TIMER_ICOUNT
+  Log("Timer interrupt every %d instructions", ICOUNT_PER_ALARM);
+  event_init(&alarm_ev, "alarm", EVENT_ICOUNT, alarm_icount_fire);
+  event_schedule(&alarm_ev, ICOUNT_PER_ALARM);
+  return;
+#endif
   struct sigaction s;
   memset(&s, 0, sizeof(s));
   s.sa_handler = alarm_sig_handler;
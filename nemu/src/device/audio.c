@@ -15,7 +15,11 @@
 
 #include <common.h>
 #include <device/map.h>
+#include <device/replay.h>
+#include <stdatomic.h>
+#ifndef CONFIG_HEADLESS
 #include <SDL2/SDL.h>
+#endif
 
 enum {
   reg_freq,
@@ -30,7 +34,123 @@ enum {
 static uint8_t *sbuf = NULL;
 static uint32_t *audio_base = NULL;
 
+/*
+sbuf is a single-producer single-consumer ring. The guest is the producer: it
+writes the samples after the ones it has written before, then writes the number
+of new bytes to `reg_count` to publish them. The consumer is the SDL audio
+thread, or the WAV sink when headless. Reading `reg_count` gives the number of
+bytes not yet consumed. Both positions only grow, and each side writes only its
+own, so no lock is needed.
+*/
+static _Atomic uint64_t sbuf_head = 0; // consumer
+static _Atomic uint64_t sbuf_tail = 0; // producer
+
+static uint32_t sbuf_count() {
+  return atomic_load_explicit(&sbuf_tail, memory_order_acquire) -
+         atomic_load_explicit(&sbuf_head, memory_order_acquire);
+}
+
+// copy at most `len` bytes out of sbuf, return the number of bytes copied
+static int sbuf_consume(uint8_t *dst, int len) {
+  uint64_t head = atomic_load_explicit(&sbuf_head, memory_order_relaxed);
+  uint64_t tail = atomic_load_explicit(&sbuf_tail, memory_order_acquire);
+  int n = tail - head < len ? tail - head : len;
+  int off = head % CONFIG_SB_SIZE;
+  int n1 = n < CONFIG_SB_SIZE - off ? n : CONFIG_SB_SIZE - off;
+  memcpy(dst, sbuf + off, n1);
+  memcpy(dst + n1, sbuf, n - n1);
+  atomic_store_explicit(&sbuf_head, head + n, memory_order_release);
+  return n;
+}
+
+#ifdef CONFIG_HEADLESS
+/*
+Without SDL the samples are consumed as soon as they are published, and are
+written to the WAV file given by --wav=FILE, if any. The guest never waits.
+*/
+static const char *wav_path = NULL;
+static FILE *wav_fp = NULL;
+static uint32_t wav_bytes = 0;
+
+void init_audio_wav(const char *path) {
+  wav_path = path;
+}
+
+static void wav_header() {
+  uint32_t freq = audio_base[reg_freq], channels = audio_base[reg_channels];
+  uint32_t hdr[11] = {
+    0x46464952, 36 + wav_bytes, 0x45564157,          // "RIFF", size, "WAVE"
+    0x20746d66, 16, 1 | (channels << 16),            // "fmt ", PCM
+    freq, freq * channels * 2, (channels * 2) | (16 << 16),
+    0x61746164, wav_bytes,                           // "data", size
+  };
+  fseek(wav_fp, 0, SEEK_SET);
+  fwrite(hdr, sizeof(hdr), 1, wav_fp);
+  fseek(wav_fp, 0, SEEK_END);
+}
+
+static void wav_close() {
+  wav_header();
+  fclose(wav_fp);
+  Log("%u bytes of audio are written to %s", wav_bytes, wav_path);
+}
+
+static void audio_open() {
+  if (wav_path == NULL || wav_fp != NULL) return;
+  wav_fp = fopen(wav_path, "wb");
+  Assert(wav_fp, "Can not open '%s'", wav_path);
+  wav_header();
+  atexit(wav_close);
+}
+
+static void audio_publish() {
+  uint8_t buf[4096];
+  int n;
+  while ((n = sbuf_consume(buf, sizeof(buf))) > 0) {
+    if (wav_fp == NULL) continue;
+    fwrite(buf, n, 1, wav_fp);
+    wav_bytes += n;
+  }
+}
+#else
+// runs on the SDL audio thread, fills silence if the guest is late
+static void audio_callback(void *userdata, uint8_t *stream, int len) {
+  int n = sbuf_consume(stream, len);
+  if (n < len) memset(stream + n, 0, len - n);
+}
+
+static void audio_open() {
+  SDL_AudioSpec s = {};
+  s.format = AUDIO_S16SYS;
+  s.userdata = NULL;
+  s.freq = audio_base[reg_freq];
+  s.channels = audio_base[reg_channels];
+  s.samples = audio_base[reg_samples];
+  s.callback = audio_callback;
+  SDL_InitSubSystem(SDL_INIT_AUDIO);
+  int ret = SDL_OpenAudio(&s, NULL);
+  Assert(ret == 0, "Can not open audio: %s", SDL_GetError());
+  SDL_PauseAudio(0);
+}
+
+static void audio_publish() {}
+#endif
+
 static void audio_io_handler(uint32_t offset, int len, bool is_write) {
+  assert(len == 4);
+  switch (offset / sizeof(uint32_t)) {
+    case reg_init:
+      if (is_write && audio_base[reg_init] && !replay_playing()) audio_open();
+      break;
+    case reg_count:
+      if (is_write) {
+        atomic_fetch_add_explicit(&sbuf_tail, audio_base[reg_count], memory_order_release);
+        audio_publish();
+      } else {
+        audio_base[reg_count] = REPLAY_INPUT(REPLAY_EV_AUDIO, sbuf_count());
+      }
+      break;
+  }
 }
 
 void init_audio() {
@@ -41,6 +161,7 @@ void init_audio() {
 #else
   add_mmio_map("audio", CONFIG_AUDIO_CTL_MMIO, audio_base, space_size, audio_io_handler);
 #endif
+  audio_base[reg_sbuf_size] = CONFIG_SB_SIZE;
 
   sbuf = (uint8_t *)new_space(CONFIG_SB_SIZE);
   add_mmio_map("audio-sbuf", CONFIG_SB_ADDR, sbuf, CONFIG_SB_SIZE, NULL);
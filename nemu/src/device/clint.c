@@ -0,0 +1,81 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <isa.h>
+#include <device/map.h>
+#include <device/alarm.h>
+#include <device/event.h>
+#include <device/intr.h>
+#include <device/replay.h>
+#include <utils.h>
+
+/*
+The CLINT of RISC-V: msip at 0x0, mtimecmp at 0x4000 and mtime at 0xbff8. mtime
+counts microseconds of the guest time, the same as the RTC, so it is read through
+REPLAY_INPUT() as well. The timer interrupt is pending while mtime >= mtimecmp. It
+is checked when mtimecmp is written and whenever dev_raise_intr() asks for it, in
+particular by an event at the deadline, on the instruction count with TIMER_ICOUNT
+and on the host time otherwise. mtime can not be written.
+*/
+#define CLINT_MSIP     0x0
+#define CLINT_MTIMECMP 0x4000
+#define CLINT_MTIME    0xbff8
+#define CLINT_SIZE     0xc000
+
+static uint8_t *clint_base = NULL;
+
+#define msip     (*(uint32_t *)(clint_base + CLINT_MSIP))
+#define mtimecmp (*(uint64_t *)(clint_base + CLINT_MTIMECMP))
+#define mtime    (*(uint64_t *)(clint_base + CLINT_MTIME))
+
+static uint64_t clint_time() {
+  return MUXDEF(CONFIG_TIMER_ICOUNT, icount_time(), get_time());
+}
+
+static event_t deadline_ev;
+
+static void update_mtip() {
+  mtime = REPLAY_INPUT(REPLAY_EV_RTC, clint_time());
+  bool mtip = mtime >= mtimecmp;
+  isa_set_intr_pin(INTR_M_TIMER, mtip);
+  // the deadline is in the log when replaying
+  if (mtip || mtimecmp == (uint64_t)-1 || replay_playing()) event_cancel(&deadline_ev);
+  else event_schedule(&deadline_ev, MUXDEF(CONFIG_TIMER_ICOUNT, icount_at(mtimecmp), mtimecmp));
+}
+
+void clint_update() {
+  update_mtip();
+}
+
+static void clint_io_handler(uint32_t offset, int len, bool is_write) {
+  if (offset >= CLINT_MTIME && offset < CLINT_MTIME + 8) {
+    // the high word is read after the low one on riscv32
+    if (!is_write && offset == CLINT_MTIME) mtime = REPLAY_INPUT(REPLAY_EV_RTC, clint_time());
+  } else if (offset >= CLINT_MTIMECMP && offset < CLINT_MTIMECMP + 8) {
+    if (is_write) update_mtip();
+  } else if (offset == CLINT_MSIP) {
+    if (is_write) {
+      msip &= 1;
+      isa_set_intr_pin(INTR_M_SOFT, msip);
+    }
+  }
+}
+
+void init_clint() {
+  clint_base = new_space(CLINT_SIZE);
+  add_mmio_map("clint", CONFIG_CLINT_MMIO, clint_base, CLINT_SIZE, clint_io_handler);
+  mtimecmp = -1;
+  event_init(&deadline_ev, "clint", MUXDEF(CONFIG_TIMER_ICOUNT, EVENT_ICOUNT, EVENT_HOST), dev_raise_intr);
+}
@@ -16,38 +16,59 @@
 #include <common.h>
 #include <utils.h>
 #include <device/alarm.h>
-#ifndef CONFIG_TARGET_AM
+#include <device/event.h>
+#include <device/intr.h>
+#include <device/replay.h>
+#if !defined(CONFIG_TARGET_AM) && !defined(CONFIG_HEADLESS)
 #include <SDL2/SDL.h>
 #endif
 
 void init_map();
 void init_serial();
+void serial_update();
 void init_timer();
 void init_vga();
+void init_gpu();
 void init_i8042();
 void init_audio();
 void init_disk();
 void init_sdcard();
+void init_net();
+void init_clint();
+void init_plic();
 void init_alarm();
 
 void send_key(uint8_t, bool);
 void vga_update_screen();
 
+// called by the CPU loop when an event is due or event_kick() asks for it
 void device_update() {
-  static uint64_t last = 0;
-  uint64_t now = get_time();
-  if (now - last < 1000000 / TIMER_HZ) {
-    return;
-  }
-  last = now;
+  event_update();
+  // the asynchronous requests from signal handlers and the events above
+  IFDEF(CONFIG_DEVICE_REPLAY, replay_update());
+  dev_intr_update();
+}
+
+static event_t frame_ev;
+
+// the work at the frame rate of the timer, not scheduled when replaying
+static void frame_update() {
+  event_schedule(&frame_ev, get_time() + 1000000 / TIMER_HZ);
 
   IFDEF(CONFIG_HAS_VGA, vga_update_screen());
+  IFDEF(CONFIG_HAS_SERIAL, IFNDEF(CONFIG_TARGET_AM, serial_update()));
 
-#ifndef CONFIG_TARGET_AM
+#if !defined(CONFIG_TARGET_AM) && !defined(CONFIG_HEADLESS)
   SDL_Event event;
   while (SDL_PollEvent(&event)) {
     switch (event.type) {
       case SDL_QUIT:
+#ifdef CONFIG_DEVICE_REPLAY
+        if (replay_mode == REPLAY_RECORD) {
+          replay_async_event(REPLAY_EV_QUIT);
+          break;
+        }
+#endif
         nemu_state.state = NEMU_QUIT;
         break;
 #ifdef CONFIG_HAS_KEYBOARD
@@ -67,7 +88,8 @@ void device_update() {
 }
 
 void sdl_clear_event_queue() {
-#ifndef CONFIG_TARGET_AM
+#if !defined(CONFIG_TARGET_AM) && !defined(CONFIG_HEADLESS)
+  if (replay_playing()) return;
   SDL_Event event;
   while (SDL_PollEvent(&event));
 #endif
@@ -80,10 +102,18 @@ void init_device() {
   IFDEF(CONFIG_HAS_SERIAL, init_serial());
   IFDEF(CONFIG_HAS_TIMER, init_timer());
   IFDEF(CONFIG_HAS_VGA, init_vga());
+  IFDEF(CONFIG_VGA_ACCEL, init_gpu());
   IFDEF(CONFIG_HAS_KEYBOARD, init_i8042());
   IFDEF(CONFIG_HAS_AUDIO, init_audio());
   IFDEF(CONFIG_HAS_DISK, init_disk());
   IFDEF(CONFIG_HAS_SDCARD, init_sdcard());
+  IFDEF(CONFIG_HAS_NET, init_net());
+  IFDEF(CONFIG_HAS_CLINT, init_clint());
+  IFDEF(CONFIG_HAS_PLIC, init_plic());
 
-  IFNDEF(CONFIG_TARGET_AM, init_alarm());
+  IFNDEF(CONFIG_TARGET_AM, if (!replay_playing()) init_alarm());
+  if (!replay_playing()) {
+    event_init(&frame_ev, "frame", EVENT_HOST, frame_update);
+    event_schedule(&frame_ev, get_time() + 1000000 / TIMER_HZ);
+  }
 }
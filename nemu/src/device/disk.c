@@ -14,6 +14,108 @@
 ***************************************************************************************/
 
 #include <device/map.h>
+#include <device/intr.h>
+#include <memory/paddr.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define BLKSZ 512
+
+/*
+The disk controller moves whole blocks between the image and the guest memory
+with DMA. The guest sets the buffer address, the block number and the number
+of blocks, then writes a command. The image is mapped into the address space of
+NEMU, so a command is done with a single memcpy. The command finishes before the
+write to `reg_cmd` returns, but a driver should still wait for DISK_BUSY to be
+cleared. If `reg_intr` is set, the line to the PLIC is raised on completion, and
+stays high until the driver writes `reg_status`.
+*/
+enum {
+  reg_blksz,
+  reg_blkcnt,
+  reg_buf,
+  reg_blkno,
+  reg_count,
+  reg_cmd,
+  reg_status,
+  reg_intr,
+  nr_reg
+};
+
+enum { DISK_CMD_NONE, DISK_CMD_READ, DISK_CMD_WRITE };
+enum { DISK_BUSY = 1, DISK_ERROR = 2 };
+
+static uint32_t *disk_base = NULL;
+static uint8_t *img = NULL;
+static uint32_t img_blkcnt = 0;
+
+static bool disk_dma(uint32_t cmd) {
+  paddr_t buf = disk_base[reg_buf];
+  uint64_t blkno = disk_base[reg_blkno], count = disk_base[reg_count];
+  uint64_t len = count * BLKSZ;
+  if (cmd != DISK_CMD_READ && cmd != DISK_CMD_WRITE) return false;
+  if (count == 0) return true;
+  if (blkno + count > img_blkcnt || !in_pmem(buf) || !in_pmem(buf + len - 1) ||
+      buf + len - 1 < buf) {
+    Log("disk: invalid DMA of %" PRIu64 " blocks from block %" PRIu64 " at " FMT_PADDR,
+        count, blkno, buf);
+    return false;
+  }
+  uint8_t *blk = img + blkno * BLKSZ;
+  if (cmd == DISK_CMD_READ) {
+    memcpy(guest_to_host(buf), blk, len);
+    // REF does not see the write of the device into its memory
+    difftest_dma(buf, len);
+  } else {
+    memcpy(blk, guest_to_host(buf), len);
+  }
+  return true;
+}
+
+static void disk_io_handler(uint32_t offset, int len, bool is_write) {
+  if (!is_write) return;
+  if (offset == reg_status * sizeof(uint32_t)) {
+    // acknowledge the interrupt
+    dev_set_irq(IRQ_DISK, false);
+    return;
+  }
+  if (offset != reg_cmd * sizeof(uint32_t)) return;
+  uint32_t cmd = disk_base[reg_cmd];
+  disk_base[reg_cmd] = DISK_CMD_NONE;
+  disk_base[reg_status] = disk_dma(cmd) ? 0 : DISK_ERROR;
+  if (disk_base[reg_intr]) dev_set_irq(IRQ_DISK, true);
+}
+
+static void init_img(const char *path) {
+  if (path[0] == '\0') return;
+  int fd = open(path, O_RDWR);
+  if (fd < 0) {
+    Log("Can not open disk image: %s", path);
+    return;
+  }
+  struct stat st;
+  Assert(fstat(fd, &st) == 0, "Can not get the size of disk image %s", path);
+  img_blkcnt = st.st_size / BLKSZ;
+  if (img_blkcnt > 0) {
+    // the writes of the guest go into the image
+    img = mmap(NULL, (size_t)img_blkcnt * BLKSZ, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    Assert(img != MAP_FAILED, "Can not map disk image %s", path);
+  }
+  close(fd);
+  Log("Disk image %s has %u blocks", path, img_blkcnt);
+}
 
 void init_disk() {
+  uint32_t space_size = sizeof(uint32_t) * nr_reg;
+  disk_base = (uint32_t *)new_space(space_size);
+#ifdef CONFIG_HAS_PORT_IO
+  add_pio_map ("disk", CONFIG_DISK_CTL_PORT, disk_base, space_size, disk_io_handler);
+#else
+  add_mmio_map("disk", CONFIG_DISK_CTL_MMIO, disk_base, space_size, disk_io_handler);
+#endif
+  init_img(CONFIG_DISK_IMG_PATH);
+  disk_base[reg_blksz] = BLKSZ;
+  disk_base[reg_blkcnt] = img_blkcnt;
 }
@@ -0,0 +1,129 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <device/event.h>
+#include <utils.h>
+
+#define MAX_EVENT 16
+#define HOST_POLL 4096 // instructions between two checks of the host time
+
+// a binary min-heap by deadline for each clock
+static event_t *queue[NR_EVENT_CLOCK][MAX_EVENT];
+static int queue_nr[NR_EVENT_CLOCK] = {};
+static uint64_t next_poll = 0;
+static volatile bool kicked = false;
+
+volatile uint64_t g_event_deadline = 0;
+
+extern uint64_t g_nr_guest_inst;
+
+static void queue_set(event_t **q, int i, event_t *e) {
+  q[i] = e;
+  e->idx = i;
+}
+
+static void sift_up(event_t **q, int i) {
+  event_t *e = q[i];
+  while (i > 0 && q[(i - 1) / 2]->when > e->when) {
+    queue_set(q, i, q[(i - 1) / 2]);
+    i = (i - 1) / 2;
+  }
+  queue_set(q, i, e);
+}
+
+static void sift_down(event_t **q, int nr, int i) {
+  event_t *e = q[i];
+  while (2 * i + 1 < nr) {
+    int c = 2 * i + 1;
+    if (c + 1 < nr && q[c + 1]->when < q[c]->when) c ++;
+    if (q[c]->when >= e->when) break;
+    queue_set(q, i, q[c]);
+    i = c;
+  }
+  queue_set(q, i, e);
+}
+
+static void queue_remove(event_t *e) {
+  event_t **q = queue[e->clock];
+  int i = e->idx, nr = -- queue_nr[e->clock];
+  e->idx = -1;
+  if (i == nr) return;
+  event_t *last = q[nr];
+  queue_set(q, i, last);
+  sift_down(q, nr, i);
+  sift_up(q, last->idx);
+}
+
+static void update_deadline() {
+  uint64_t d = queue_nr[EVENT_ICOUNT] > 0 ? queue[EVENT_ICOUNT][0]->when : UINT64_MAX;
+  if (queue_nr[EVENT_HOST] > 0 && next_poll < d) d = next_poll;
+  g_event_deadline = d;
+  // do not lose a kick from a signal handler meanwhile
+  if (kicked) g_event_deadline = 0;
+}
+
+void event_init(event_t *e, const char *name, int clock, event_handler_t handler) {
+  assert(clock >= 0 && clock < NR_EVENT_CLOCK);
+  *e = (event_t) { .name = name, .clock = clock, .handler = handler, .idx = -1 };
+}
+
+void event_schedule(event_t *e, uint64_t when) {
+  event_t **q = queue[e->clock];
+  if (e->idx >= 0) queue_remove(e);
+  Assert(queue_nr[e->clock] < MAX_EVENT, "Too many events, can not schedule '%s'", e->name);
+  e->when = when;
+  queue_set(q, queue_nr[e->clock] ++, e);
+  sift_up(q, e->idx);
+  update_deadline();
+}
+
+void event_cancel(event_t *e) {
+  if (e->idx < 0) return;
+  queue_remove(e);
+  update_deadline();
+}
+
+void event_kick() {
+  kicked = true;
+  g_event_deadline = 0;
+}
+
+static void run_due(int clock, uint64_t now) {
+  event_t **q = queue[clock];
+  // bounded, so that a handler scheduling its event for now again can not loop
+  int nr = queue_nr[clock];
+  while (nr -- > 0 && queue_nr[clock] > 0 && q[0]->when <= now) {
+    event_t *e = q[0];
+    queue_remove(e);
+    e->handler();
+  }
+}
+
+void event_update() {
+  kicked = false;
+  run_due(EVENT_ICOUNT, g_nr_guest_inst);
+  if (queue_nr[EVENT_HOST] > 0) {
+    run_due(EVENT_HOST, get_time());
+    next_poll = g_nr_guest_inst + HOST_POLL;
+  }
+  update_deadline();
+}
+
+uint64_t event_host_wait(uint64_t max) {
+  if (queue_nr[EVENT_HOST] == 0) return max;
+  uint64_t when = queue[EVENT_HOST][0]->when, now = get_time();
+  if (when <= now) return 0;
+  return when - now < max ? when - now : max;
+}
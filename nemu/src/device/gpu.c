@@ -0,0 +1,227 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <device/map.h>
+#include <memory/paddr.h>
+
+/*
+2D accelerator of the VGA controller. The guest sets the registers, then writes a
+command, which is done before the write returns:
+- GPU_CMD_MEMCPY copies `size` bytes from the guest memory at `src` to the GPU memory
+  at `dst` (AM_GPU_MEMCPY).
+- GPU_CMD_RENDER draws the canvas tree whose root is at `dst` in the GPU memory
+  to the screen (AM_GPU_RENDER).
+- GPU_CMD_FILL fills the rectangle (x, y, w, h) of the screen with `color`.
+- GPU_CMD_BLIT copies a w * h picture from the guest memory at `src` to (x, y) of
+  the screen, the same as AM_GPU_FBDRAW.
+The rectangles are clipped by the screen. A canvas is drawn into the rectangle
+(x1, y1, w1, h1) of its parent, and its content of w * h pixels is scaled to it.
+The pixels of AM carry no alpha, so a canvas covers what is below it.
+*/
+enum {
+  reg_cmd,
+  reg_status,
+  reg_src,
+  reg_dst,
+  reg_size,
+  reg_x,
+  reg_y,
+  reg_w,
+  reg_h,
+  reg_color,
+  nr_reg
+};
+
+enum { GPU_CMD_NONE, GPU_CMD_MEMCPY, GPU_CMD_RENDER, GPU_CMD_FILL, GPU_CMD_BLIT };
+enum { GPU_ERROR = 1 };
+
+// the same as `struct gpu_canvas` in amdev.h
+#define CANVAS_TEXTURE 1
+#define CANVAS_SUBTREE 2
+#define CANVAS_NULL    0xffffffff
+typedef struct {
+  uint16_t type, w, h, x1, y1, w1, h1;
+  uint32_t sibling;
+  union {
+    uint32_t child;
+    struct { uint16_t w, h; uint32_t pixels; } __attribute__((packed)) texture;
+  };
+} __attribute__((packed)) canvas_t;
+
+#define MAX_DEPTH  16
+#define MAX_CANVAS 4096 // against cycles in the tree
+#define MAX_COORD  (1 << 24)
+
+// a rectangle on the screen, for the content of cw * ch pixels of a canvas
+typedef struct { int64_t x, y, w, h, cw, ch; } area_t;
+
+static uint32_t *gpu_base = NULL;
+static uint8_t *gmem = NULL;
+static uint32_t *fb = NULL;
+static int screen_w = 0, screen_h = 0;
+static int nr_canvas = 0;
+
+uint32_t *vga_vmem();
+void vga_screen_size(int *w, int *h);
+void vga_mark_rows(int y, int h);
+
+static bool in_gmem(uint64_t addr, uint64_t len) {
+  return addr <= CONFIG_GPU_MEM_SIZE && len <= CONFIG_GPU_MEM_SIZE - addr;
+}
+
+// in 64 bits, since `len` of a blit may not fit in paddr_t
+static bool in_guest(uint64_t addr, uint64_t len) {
+  if (len == 0) return true;
+  if (len > CONFIG_MSIZE || addr < CONFIG_MBASE) return false;
+  return addr - CONFIG_MBASE <= CONFIG_MSIZE - len;
+}
+
+static inline int64_t max64(int64_t a, int64_t b) { return a > b ? a : b; }
+static inline int64_t min64(int64_t a, int64_t b) { return a < b ? a : b; }
+
+// clip (x, y, w, h) by `clip`, return false if nothing is left
+static bool clip_rect(int64_t *x, int64_t *y, int64_t *w, int64_t *h, const area_t *clip) {
+  int64_t x0 = max64(*x, clip->x), y0 = max64(*y, clip->y);
+  int64_t x1 = min64(*x + *w, clip->x + clip->w), y1 = min64(*y + *h, clip->y + clip->h);
+  if (x0 >= x1 || y0 >= y1) return false;
+  *x = x0; *y = y0; *w = x1 - x0; *h = y1 - y0;
+  return true;
+}
+
+static const area_t *screen_area() {
+  static area_t a;
+  a = (area_t) { 0, 0, screen_w, screen_h, screen_w, screen_h };
+  return &a;
+}
+
+// copy the rows of `src` with `pitch` pixels to (x, y, w, h) of the screen
+static void blit(int x, int y, int w, int h, const uint32_t *src, int64_t pitch) {
+  uint32_t *dst = fb + y * screen_w + x;
+  for (int j = 0; j < h; j ++, dst += screen_w, src += pitch) {
+    memcpy(dst, src, w * sizeof(uint32_t));
+  }
+  vga_mark_rows(y, h);
+}
+
+static void fill(int x, int y, int w, int h, uint32_t color) {
+  uint32_t *dst = fb + y * screen_w + x;
+  for (int j = 0; j < h; j ++, dst += screen_w) {
+    for (int i = 0; i < w; i ++) dst[i] = color;
+  }
+  vga_mark_rows(y, h);
+}
+
+/*
+Draw a texture of tw * th pixels to `a`, clipped by `clip`. A texture of the same
+size as its area is copied by rows, otherwise it is scaled by the nearest pixel.
+*/
+static bool draw_texture(const area_t *a, const area_t *clip, int tw, int th, uint32_t pixels) {
+  if (!in_gmem(pixels, (uint64_t)tw * th * sizeof(uint32_t))) return false;
+  int64_t x = a->x, y = a->y, w = a->w, h = a->h;
+  if (tw == 0 || th == 0 || !clip_rect(&x, &y, &w, &h, clip)) return true;
+  const uint32_t *tex = (uint32_t *)(gmem + pixels);
+  if (a->w == tw && a->h == th) {
+    blit(x, y, w, h, tex + (y - a->y) * tw + (x - a->x), tw);
+    return true;
+  }
+  uint32_t *dst = fb + y * screen_w + x;
+  for (int j = 0; j < h; j ++, dst += screen_w) {
+    const uint32_t *row = tex + (y + j - a->y) * th / a->h * tw;
+    for (int i = 0; i < w; i ++) dst[i] = row[(x + i - a->x) * tw / a->w];
+  }
+  vga_mark_rows(y, h);
+  return true;
+}
+
+// draw the canvas at `ptr` and its siblings into `parent`
+static bool render(uint32_t ptr, const area_t *parent, const area_t *clip, int depth) {
+  if (depth > MAX_DEPTH) return false;
+  for (; ptr != CANVAS_NULL; ) {
+    if (++ nr_canvas > MAX_CANVAS || !in_gmem(ptr, sizeof(canvas_t))) return false;
+    canvas_t c;
+    memcpy(&c, gmem + ptr, sizeof(c));
+    if (parent->cw == 0 || parent->ch == 0) return true;
+    area_t a = {
+      .x = parent->x + c.x1 * parent->w / parent->cw,
+      .y = parent->y + c.y1 * parent->h / parent->ch,
+      .w = c.w1 * parent->w / parent->cw,
+      .h = c.h1 * parent->h / parent->ch,
+      .cw = c.w, .ch = c.h,
+    };
+    if (a.w > MAX_COORD || a.h > MAX_COORD || llabs(a.x) > MAX_COORD || llabs(a.y) > MAX_COORD) return false;
+    area_t sub = a;
+    if (clip_rect(&sub.x, &sub.y, &sub.w, &sub.h, clip)) {
+      bool ok = true;
+      if (c.type == CANVAS_TEXTURE) {
+        ok = draw_texture(&a, &sub, c.texture.w, c.texture.h, c.texture.pixels);
+      } else if (c.type == CANVAS_SUBTREE) {
+        ok = render(c.child, &a, &sub, depth + 1);
+      } else ok = false;
+      if (!ok) return false;
+    }
+    ptr = c.sibling;
+  }
+  return true;
+}
+
+static bool gpu_exec(uint32_t cmd) {
+  uint32_t src = gpu_base[reg_src], dst = gpu_base[reg_dst], size = gpu_base[reg_size];
+  int64_t x = (int32_t)gpu_base[reg_x], y = (int32_t)gpu_base[reg_y];
+  int64_t w = (int32_t)gpu_base[reg_w], h = (int32_t)gpu_base[reg_h];
+  if ((cmd == GPU_CMD_FILL || cmd == GPU_CMD_BLIT) &&
+      (w < 0 || h < 0 || w > MAX_COORD || h > MAX_COORD)) return false;
+  switch (cmd) {
+    case GPU_CMD_MEMCPY:
+      if (!in_gmem(dst, size) || !in_guest(src, size)) return false;
+      if (size > 0) memcpy(gmem + dst, guest_to_host(src), size);
+      return true;
+    case GPU_CMD_RENDER:
+      nr_canvas = 0;
+      return render(dst, screen_area(), screen_area(), 0);
+    case GPU_CMD_FILL:
+      if (clip_rect(&x, &y, &w, &h, screen_area())) fill(x, y, w, h, gpu_base[reg_color]);
+      return true;
+    case GPU_CMD_BLIT: {
+      int64_t pitch = w, x0 = x, y0 = y;
+      if (!in_guest(src, w * h * sizeof(uint32_t))) return false;
+      if (!clip_rect(&x, &y, &w, &h, screen_area())) return true;
+      const uint32_t *pixels = (uint32_t *)guest_to_host(src);
+      blit(x, y, w, h, pixels + (y - y0) * pitch + (x - x0), pitch);
+      return true;
+    }
+    default: return false;
+  }
+}
+
+static void gpu_io_handler(uint32_t offset, int len, bool is_write) {
+  if (!is_write || offset != reg_cmd * sizeof(uint32_t)) return;
+  uint32_t cmd = gpu_base[reg_cmd];
+  gpu_base[reg_cmd] = GPU_CMD_NONE;
+  gpu_base[reg_status] = gpu_exec(cmd) ? 0 : GPU_ERROR;
+  if (gpu_base[reg_status]) Log("gpu: command %d fails", cmd);
+}
+
+void init_gpu() {
+  gpu_base = (uint32_t *)new_space(nr_reg * sizeof(uint32_t));
+#ifdef CONFIG_HAS_PORT_IO
+  add_pio_map ("gpu", CONFIG_GPU_CTL_PORT, gpu_base, nr_reg * sizeof(uint32_t), gpu_io_handler);
+#else
+  add_mmio_map("gpu", CONFIG_GPU_CTL_MMIO, gpu_base, nr_reg * sizeof(uint32_t), gpu_io_handler);
+#endif
+  gmem = calloc(CONFIG_GPU_MEM_SIZE, 1);
+  assert(gmem);
+  fb = vga_vmem();
+  vga_screen_size(&screen_w, &screen_h);
+}
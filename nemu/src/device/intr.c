@@ -14,6 +14,62 @@
 ***************************************************************************************/
 
 #include <isa.h>
+#include <device/alarm.h>
+#include <device/event.h>
+#include <device/intr.h>
+#include <device/replay.h>
+#ifndef CONFIG_TARGET_AM
+#include <unistd.h>
+#endif
+
+/*
+The interrupts of the devices which are driven by synchronous events, such as the
+completion of a command of the disk, are raised in place with dev_set_irq(). The
+ones depending on the host, such as the time for the CLINT or the input of the
+serial, are checked again in dev_inject_intr() when dev_raise_intr() asks for it.
+This is done at an instruction boundary, so that the check reads the host through
+REPLAY_INPUT(), and is replayed at the same instruction.
+*/
+static volatile bool intr_request = false;
+
+void serial_update_irq();
+
+void dev_inject_intr() {
+  IFDEF(CONFIG_HAS_CLINT, clint_update());
+  IFDEF(CONFIG_HAS_SERIAL, IFNDEF(CONFIG_TARGET_AM, serial_update_irq()));
+}
 
 void dev_raise_intr() {
+#ifdef CONFIG_DEVICE_REPLAY
+  // the injection point is decided in replay_update() to be reproducible
+  if (replay_mode != REPLAY_OFF) {
+    replay_async_event(REPLAY_EV_INTR);
+    return;
+  }
+#endif
+  intr_request = true;
+  event_kick();
+}
+
+void dev_intr_update() {
+  if (unlikely(intr_request)) {
+    intr_request = false;
+    dev_inject_intr();
+  }
+}
+
+void dev_set_irq(int irq, bool level) {
+  IFDEF(CONFIG_HAS_PLIC, plic_set_irq(irq, level));
+}
+
+// sleep until the next host event, such as the deadline of the CLINT or the next
+// frame, instead of spinning on wfi. Guest time does not pass while sleeping with
+// TIMER_ICOUNT, so wfi spins until the next instruction-count event.
+void dev_idle() {
+#ifndef CONFIG_TARGET_AM
+  if (replay_playing() || ISDEF(CONFIG_TIMER_ICOUNT)) return;
+  uint64_t us = event_host_wait(1000000 / TIMER_HZ);
+  if (us > 0) usleep(us);
+  event_kick();
+#endif
 }
@@ -55,9 +55,12 @@ void add_mmio_map(const char *name, paddr_t addr, void *space, uint32_t len, io_
 
 /* bus interface */
 word_t mmio_read(paddr_t addr, int len) {
-  return map_read(addr, len, fetch_mmio_map(addr));
+  word_t ret = map_read(addr, len, fetch_mmio_map(addr));
+  difftest_mmio(addr, len, ret, false);
+  return ret;
 }
 
 void mmio_write(paddr_t addr, int len, word_t data) {
   map_write(addr, len, data, fetch_mmio_map(addr));
+  difftest_mmio(addr, len, data, true);
 }
@@ -15,10 +15,18 @@
 
 #include <device/map.h>
 #include <utils.h>
+#include <device/replay.h>
 
 #define KEYDOWN_MASK 0x8000
 
-#ifndef CONFIG_TARGET_AM
+#if defined(CONFIG_HEADLESS)
+#define NEMU_KEY_NONE 0
+
+// no key is ever pressed without a window
+static uint32_t key_dequeue() {
+  return NEMU_KEY_NONE;
+}
+#elif !defined(CONFIG_TARGET_AM)
 #include <SDL2/SDL.h>
 
 // Note that this is not the standard
@@ -85,7 +93,7 @@ static uint32_t *i8042_data_port_base = NULL;
 static void i8042_data_io_handler(uint32_t offset, int len, bool is_write) {
   assert(!is_write);
   assert(offset == 0);
-  i8042_data_port_base[0] = key_dequeue();
+  i8042_data_port_base[0] = REPLAY_INPUT(REPLAY_EV_KEYBOARD, key_dequeue());
 }
 
 void init_i8042() {
@@ -96,5 +104,5 @@ void init_i8042() {
 #else
   add_mmio_map("keyboard", CONFIG_I8042_DATA_MMIO, i8042_data_port_base, 4, i8042_data_io_handler);
 #endif
-  IFNDEF(CONFIG_TARGET_AM, init_keymap());
+  IFNDEF(CONFIG_TARGET_AM, IFNDEF(CONFIG_HEADLESS, init_keymap()));
 }
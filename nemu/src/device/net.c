@@ -0,0 +1,406 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#include <utils.h>
+#include <device/map.h>
+#include <device/event.h>
+#include <device/intr.h>
+#include <device/replay.h>
+#include <memory/paddr.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/*
+A NIC with a TX ring and an RX ring of descriptors in the guest memory. A
+descriptor {addr, len, flags} points to a frame buffer. The driver fills the
+descriptors after the tail of a ring and writes the new tail to `reg_tx_tail` or
+`reg_rx_tail`. The device consumes them from the head, sets NET_DESC_DONE and
+advances `reg_tx_head` or `reg_rx_head`. The indexes only grow, and are taken
+modulo the size of the ring, a power of 2.
+
+The frames are never staged in the device: a TX frame is handed to the backend
+from the guest memory, and an RX frame is received in place into the buffer
+posted by the driver. TX is done before the write to `reg_tx_tail` returns. RX
+frames are taken from the backend when the driver posts buffers, reads
+`reg_rx_head` or sends a frame, and every NET_POLL_US for a backend fed by the
+host. If `reg_intr` is set, the line to the PLIC is raised when frames are sent
+or received, and stays high until the driver writes `reg_status`.
+*/
+enum {
+  reg_frame_max,
+  reg_tx_ring,
+  reg_tx_size,
+  reg_tx_head,
+  reg_tx_tail,
+  reg_rx_ring,
+  reg_rx_size,
+  reg_rx_head,
+  reg_rx_tail,
+  reg_status,
+  reg_intr,
+  reg_tx_drop,
+  reg_rx_drop,
+  nr_reg
+};
+
+enum { NET_RX_DONE = 1, NET_TX_DONE = 2, NET_ERROR = 4 };
+enum { NET_DESC_DONE = 1, NET_DESC_ERROR = 2 };
+
+typedef struct {
+  uint32_t addr;
+  uint16_t len;   // TX: the length of the frame, RX: the size of the buffer, then the length
+  uint16_t flags;
+} net_desc;
+
+// an Ethernet frame with a VLAN tag, without FCS, rounded up
+#define NET_FRAME_MAX 1536
+#define NET_RING_MAX 4096
+#define NET_POLL_US 1000
+
+typedef struct {
+  const char *name;
+  // return false if the frame is dropped
+  bool (*send)(const uint8_t *buf, uint32_t len);
+  // receive a frame into `buf`, return its length, or 0 if there is none. A frame
+  // longer than `size` is consumed, and its whole length is returned.
+  uint32_t (*recv)(uint8_t *buf, uint32_t size);
+  // only for the backends fed by the host: whether a frame is waiting
+  bool (*pending)();
+} net_backend;
+
+static uint32_t *net_base = NULL;
+static const net_backend *backend = NULL;
+static uint32_t tx_head = 0, rx_head = 0, status = 0;
+static uint32_t tx_drop = 0, rx_drop = 0;
+static event_t poll_ev;
+
+// loopback: the frames sent are received again
+
+#define LOOP_NR 256
+
+static struct {
+  uint32_t len;
+  uint8_t data[NET_FRAME_MAX];
+} loop_q[LOOP_NR];
+static uint32_t loop_head = 0, loop_tail = 0;
+
+static bool loop_send(const uint8_t *buf, uint32_t len) {
+  if (loop_tail - loop_head == LOOP_NR) return false;
+  loop_q[loop_tail % LOOP_NR].len = len;
+  memcpy(loop_q[loop_tail % LOOP_NR].data, buf, len);
+  loop_tail ++;
+  return true;
+}
+
+static uint32_t loop_recv(uint8_t *buf, uint32_t size) {
+  if (loop_head == loop_tail) return 0;
+  uint32_t len = loop_q[loop_head % LOOP_NR].len;
+  if (len <= size) memcpy(buf, loop_q[loop_head % LOOP_NR].data, len);
+  loop_head ++;
+  return len;
+}
+
+static const net_backend loop_backend = { "loopback", loop_send, loop_recv, NULL };
+
+// pcap: the frames sent are written to a capture, and the frames of another
+// capture are received as fast as the driver posts buffers
+
+#define PCAP_MAGIC    0xa1b2c3d4
+#define PCAP_MAGIC_NS 0xa1b23c4d
+#define LINKTYPE_ETHERNET 1
+
+typedef struct {
+  uint32_t magic;
+  uint16_t major, minor;
+  int32_t zone;
+  uint32_t sigfigs, snaplen, linktype;
+} pcap_hdr;
+
+typedef struct {
+  uint32_t sec, usec, incl_len, orig_len;
+} pcap_rec;
+
+static FILE *pcap_out = NULL, *pcap_in = NULL;
+
+static bool pcap_send(const uint8_t *buf, uint32_t len) {
+  if (pcap_out == NULL) return true;
+  uint64_t us = get_time();
+  pcap_rec r = { .sec = us / 1000000, .usec = us % 1000000, .incl_len = len, .orig_len = len };
+  return fwrite(&r, sizeof(r), 1, pcap_out) == 1 && fwrite(buf, len, 1, pcap_out) == 1;
+}
+
+static uint32_t pcap_recv(uint8_t *buf, uint32_t size) {
+  pcap_rec r;
+  while (pcap_in != NULL && fread(&r, sizeof(r), 1, pcap_in) == 1) {
+    if (r.incl_len == 0) continue;
+    if (r.incl_len > size) {
+      if (fseek(pcap_in, r.incl_len, SEEK_CUR) != 0) break;
+      return r.incl_len;
+    }
+    if (fread(buf, r.incl_len, 1, pcap_in) != 1) break;
+    return r.incl_len;
+  }
+  return 0;
+}
+
+static const net_backend pcap_backend = { "pcap", pcap_send, pcap_recv, NULL };
+
+static void pcap_close() {
+  if (pcap_out) fclose(pcap_out);
+  if (pcap_in) fclose(pcap_in);
+  pcap_out = pcap_in = NULL;
+}
+
+static void pcap_open(const char *out, const char *in) {
+  if (out != NULL && out[0] != '\0') {
+    pcap_out = fopen(out, "wb");
+    Assert(pcap_out, "Can not open '%s'", out);
+    pcap_hdr h = { .magic = PCAP_MAGIC, .major = 2, .minor = 4,
+      .snaplen = NET_FRAME_MAX, .linktype = LINKTYPE_ETHERNET };
+    Assert(fwrite(&h, sizeof(h), 1, pcap_out) == 1, "Can not write '%s'", out);
+  }
+  if (in != NULL && in[0] != '\0') {
+    pcap_in = fopen(in, "rb");
+    Assert(pcap_in, "Can not open '%s'", in);
+    pcap_hdr h;
+    Assert(fread(&h, sizeof(h), 1, pcap_in) == 1 &&
+        (h.magic == PCAP_MAGIC || h.magic == PCAP_MAGIC_NS) && h.linktype == LINKTYPE_ETHERNET,
+        "'%s' is not a little-endian pcap of Ethernet frames", in);
+  }
+  atexit(pcap_close);
+}
+
+// a bridge to another NEMU on the same host through datagrams of a Unix-domain
+// socket, one frame per datagram. A frame is dropped if the peer is not there or
+// can not keep up, as on a wire.
+
+static int sock_fd = -1;
+static struct sockaddr_un sock_peer = { .sun_family = AF_UNIX };
+
+static bool sock_send(const uint8_t *buf, uint32_t len) {
+  if (sock_fd < 0) return false;
+  return sendto(sock_fd, buf, len, MSG_DONTWAIT, (struct sockaddr *)&sock_peer, sizeof(sock_peer)) == len;
+}
+
+static uint32_t sock_recv(uint8_t *buf, uint32_t size) {
+  if (sock_fd < 0) return 0;
+  ssize_t n = recv(sock_fd, buf, size, MSG_DONTWAIT | MSG_TRUNC);
+  return n > 0 ? n : 0;
+}
+
+static bool sock_pending() {
+  struct pollfd p = { .fd = sock_fd, .events = POLLIN };
+  return sock_fd >= 0 && poll(&p, 1, 0) > 0;
+}
+
+static const net_backend sock_backend = { "unix", sock_send, sock_recv, sock_pending };
+
+static void sock_set_path(struct sockaddr_un *addr, const char *path) {
+  Assert(strlen(path) < sizeof(addr->sun_path), "The path of the socket is too long: %s", path);
+  strcpy(addr->sun_path, path);
+}
+
+static void sock_open(const char *local, const char *peer) {
+  Assert(local != NULL && peer != NULL, "Usage: --net=unix:LOCAL,PEER");
+  sock_set_path(&sock_peer, peer);
+  // the frames of the peer are fed back from the log
+  if (replay_playing()) return;
+  struct sockaddr_un addr = { .sun_family = AF_UNIX };
+  sock_set_path(&addr, local);
+  sock_fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+  Assert(sock_fd >= 0, "Can not create a socket");
+  unlink(local);
+  Assert(bind(sock_fd, (struct sockaddr *)&addr, sizeof(addr)) == 0, "Can not bind the socket to %s", local);
+}
+
+// SPEC is loop, pcap:OUT[,IN] or unix:LOCAL,PEER
+void init_net_backend(const char *spec) {
+  if (spec == NULL || strcmp(spec, "loop") == 0) {
+    backend = &loop_backend;
+    return;
+  }
+  char *s = strdup(spec);
+  char *arg = strchr(s, ':');
+  char *arg2 = NULL;
+  if (arg != NULL) {
+    *arg ++ = '\0';
+    arg2 = strchr(arg, ',');
+    if (arg2 != NULL) *arg2 ++ = '\0';
+  }
+  if (strcmp(s, "pcap") == 0) {
+    pcap_open(arg, arg2);
+    backend = &pcap_backend;
+  } else if (strcmp(s, "unix") == 0) {
+    sock_open(arg, arg2);
+    backend = &sock_backend;
+  } else {
+    panic("Unknown network backend '%s'", spec);
+  }
+  Log("Network backend: %s", spec);
+  free(s);
+}
+
+// the device
+
+#ifdef CONFIG_DEVICE_REPLAY
+static uint64_t frame_word(const uint8_t *p, int n) {
+  uint64_t w = 0;
+  memcpy(&w, p, n);
+  return w;
+}
+#endif
+
+// the frames from the host are logged, 8 bytes per record, to be replayed
+static uint32_t net_recv(uint8_t *buf, uint32_t size) {
+  if (backend->pending == NULL) return backend->recv(buf, size);
+  uint32_t len = REPLAY_INPUT(REPLAY_EV_NET, backend->recv(buf, size));
+#ifdef CONFIG_DEVICE_REPLAY
+  // a frame longer than `size` is dropped, and its content is not logged
+  if (replay_mode != REPLAY_OFF && len <= size) {
+    for (uint32_t i = 0; i < len; i += 8) {
+      int n = len - i < 8 ? len - i : 8;
+      uint64_t w = REPLAY_INPUT(REPLAY_EV_NET, frame_word(buf + i, n));
+      memcpy(buf + i, &w, n);
+    }
+  }
+#endif
+  return len;
+}
+
+static bool in_guest(paddr_t addr, uint32_t len) {
+  return len > 0 && in_pmem(addr) && in_pmem(addr + len - 1) && addr + len - 1 >= addr;
+}
+
+// the descriptor `idx` of a ring, NULL if the ring is invalid
+static net_desc *net_desc_at(int reg_ring, uint32_t idx, paddr_t *paddr) {
+  paddr_t ring = net_base[reg_ring];
+  uint32_t size = net_base[reg_ring + 1];
+  if (size == 0 || size > NET_RING_MAX || (size & (size - 1)) != 0 ||
+      ring % sizeof(net_desc) != 0 || !in_guest(ring, size * sizeof(net_desc))) {
+    if (!(status & NET_ERROR)) {
+      Log("net: invalid ring of %u descriptors at " FMT_PADDR, size, ring);
+    }
+    status |= NET_ERROR;
+    return NULL;
+  }
+  *paddr = ring + (idx & (size - 1)) * sizeof(net_desc);
+  return (net_desc *)guest_to_host(*paddr);
+}
+
+static void net_update_irq() {
+  dev_set_irq(IRQ_NET, (status & net_base[reg_intr] & (NET_RX_DONE | NET_TX_DONE)) != 0);
+}
+
+static void net_rx() {
+  uint32_t tail = net_base[reg_rx_tail];
+  if (tail - rx_head > NET_RING_MAX) return;
+  while (rx_head != tail) {
+    paddr_t paddr;
+    net_desc *d = net_desc_at(reg_rx_ring, rx_head, &paddr);
+    if (d == NULL) return;
+    if (!in_guest(d->addr, d->len)) {
+      d->flags = NET_DESC_ERROR;
+    } else {
+      uint32_t len = net_recv(guest_to_host(d->addr), d->len);
+      if (len == 0) return;
+      if (len > d->len) {
+        rx_drop ++;
+        continue;
+      }
+      // REF does not see the writes of the device into its memory
+      difftest_dma(d->addr, len);
+      d->len = len;
+      d->flags = NET_DESC_DONE;
+    }
+    difftest_dma(paddr, sizeof(*d));
+    rx_head ++;
+    status |= NET_RX_DONE;
+  }
+}
+
+static void net_tx() {
+  uint32_t tail = net_base[reg_tx_tail];
+  if (tail - tx_head > NET_RING_MAX) return;
+  while (tx_head != tail) {
+    paddr_t paddr;
+    net_desc *d = net_desc_at(reg_tx_ring, tx_head, &paddr);
+    if (d == NULL) return;
+    if (d->len > NET_FRAME_MAX || !in_guest(d->addr, d->len)) {
+      d->flags = NET_DESC_ERROR;
+      tx_drop ++;
+    } else {
+      if (!backend->send(guest_to_host(d->addr), d->len)) tx_drop ++;
+      d->flags = NET_DESC_DONE;
+    }
+    difftest_dma(paddr, sizeof(*d));
+    tx_head ++;
+    status |= NET_TX_DONE;
+  }
+}
+
+// called as the event of the host poll, or by replay_update() at the same point
+void net_poll_rx() {
+  net_rx();
+  net_update_irq();
+}
+
+static void net_poll() {
+  event_schedule(&poll_ev, get_time() + NET_POLL_US);
+  if (!backend->pending()) return;
+#ifdef CONFIG_DEVICE_REPLAY
+  if (replay_mode == REPLAY_RECORD) {
+    replay_async_event(REPLAY_EV_NET_POLL);
+    return;
+  }
+#endif
+  net_poll_rx();
+}
+
+static void net_io_handler(uint32_t offset, int len, bool is_write) {
+  switch (offset / sizeof(uint32_t)) {
+    case reg_tx_tail: if (is_write) { net_tx(); net_rx(); } break;
+    case reg_rx_tail: if (is_write) net_rx(); break;
+    case reg_rx_head: if (!is_write) net_rx(); break;
+    case reg_status: if (is_write) status = 0; break;
+    default: break;
+  }
+  net_update_irq();
+  // the read-only registers
+  net_base[reg_frame_max] = NET_FRAME_MAX;
+  net_base[reg_tx_head] = tx_head;
+  net_base[reg_rx_head] = rx_head;
+  net_base[reg_status] = status;
+  net_base[reg_tx_drop] = tx_drop;
+  net_base[reg_rx_drop] = rx_drop;
+}
+
+void init_net() {
+  uint32_t space_size = sizeof(uint32_t) * nr_reg;
+  net_base = (uint32_t *)new_space(space_size);
+#ifdef CONFIG_HAS_PORT_IO
+  add_pio_map ("net", CONFIG_NET_CTL_PORT, net_base, space_size, net_io_handler);
+#else
+  add_mmio_map("net", CONFIG_NET_CTL_MMIO, net_base, space_size, net_io_handler);
+#endif
+  if (backend == NULL) backend = &loop_backend;
+  net_base[reg_frame_max] = NET_FRAME_MAX;
+  if (backend->pending != NULL && !replay_playing()) {
+    event_init(&poll_ev, "net", EVENT_HOST, net_poll);
+    event_schedule(&poll_ev, get_time() + NET_POLL_US);
+  }
+}
@@ -0,0 +1,98 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <isa.h>
+#include <device/map.h>
+#include <device/intr.h>
+
+/*
+A PLIC with NR_IRQ sources and a single context for M mode. The sources are
+level-triggered: a source is pending while its line is high, unless it has been
+claimed and not completed yet. mip.MEIP follows whether an enabled source with a
+priority above the threshold is pending.
+*/
+#define PLIC_PRIORITY  0x0
+#define PLIC_PENDING   0x1000
+#define PLIC_ENABLE    0x2000
+#define PLIC_SIZE      (PLIC_ENABLE + 4)
+#define PLIC_CTX       0x200000
+#define PLIC_THRESHOLD 0x0
+#define PLIC_CLAIM     0x4
+#define PLIC_CTX_SIZE  8
+
+static uint32_t *plic_base = NULL;
+static uint32_t *ctx_base = NULL;
+static uint32_t level = 0, claimed = 0;
+
+#define priority(irq) plic_base[(PLIC_PRIORITY / 4) + (irq)]
+#define pending       plic_base[PLIC_PENDING / 4]
+#define enable        plic_base[PLIC_ENABLE / 4]
+#define threshold     ctx_base[PLIC_THRESHOLD / 4]
+#define claim         ctx_base[PLIC_CLAIM / 4]
+
+// the pending source with the highest priority, 0 if none
+static int plic_best() {
+  int best = 0;
+  for (int i = 1; i < NR_IRQ; i ++) {
+    if ((pending & enable & BITMASK(NR_IRQ) & (1u << i)) && priority(i) > threshold &&
+        (best == 0 || priority(i) > priority(best))) {
+      best = i;
+    }
+  }
+  return best;
+}
+
+static void plic_update() {
+  pending = level & ~claimed;
+  isa_set_intr_pin(INTR_M_EXT, plic_best() != 0);
+}
+
+void plic_set_irq(int irq, bool high) {
+  assert(irq > 0 && irq < NR_IRQ);
+  if (high) level |= 1u << irq;
+  else level &= ~(1u << irq);
+  plic_update();
+}
+
+static void plic_io_handler(uint32_t offset, int len, bool is_write) {
+  if (is_write) {
+    // the pending bits are read-only
+    if (offset == PLIC_PENDING) pending = level & ~claimed;
+    plic_update();
+  }
+}
+
+static void plic_ctx_io_handler(uint32_t offset, int len, bool is_write) {
+  if (offset != PLIC_CLAIM) {
+    if (is_write) plic_update();
+    return;
+  }
+  if (!is_write) {
+    // claim
+    claim = plic_best();
+    if (claim != 0) claimed |= 1u << claim;
+  } else {
+    // complete
+    if (claim > 0 && claim < NR_IRQ) claimed &= ~(1u << claim);
+  }
+  plic_update();
+}
+
+void init_plic() {
+  plic_base = (uint32_t *)new_space(PLIC_SIZE);
+  add_mmio_map("plic", CONFIG_PLIC_MMIO, plic_base, PLIC_SIZE, plic_io_handler);
+  ctx_base = (uint32_t *)new_space(PLIC_CTX_SIZE);
+  add_mmio_map("plic-ctx", CONFIG_PLIC_MMIO + PLIC_CTX, ctx_base, PLIC_CTX_SIZE, plic_ctx_io_handler);
+}
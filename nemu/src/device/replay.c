@@ -0,0 +1,188 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <device/replay.h>
+#include <device/event.h>
+#include <signal.h>
+
+/*
+Record and replay of device input.
+When recording, every value read from a nondeterministic device and every asynchronous
+event (interrupt, window closed) is logged with the number of instructions executed
+before it. When replaying, the values and events are fed back from the log at the same
+instruction counts, without touching SDL or the host clock, so the run is reproducible
+and not paced by real time.
+Asynchronous events are only delivered at instruction boundaries in replay_update(),
+also when recording, so that their injection points can be reproduced exactly. When
+replaying, replay_update() is an event scheduled at the instruction count of the next
+record in the log.
+*/
+
+#define REPLAY_MAGIC "NEMUREP1"
+#define REPLAY_BUF_NR 1024
+
+typedef struct {
+  uint64_t icount;
+  uint32_t ev;
+  uint32_t pad;
+  uint64_t value;
+} replay_rec;
+
+int replay_mode = REPLAY_OFF;
+
+extern uint64_t g_nr_guest_inst;
+
+static FILE *replay_fp = NULL;
+static replay_rec buf[REPLAY_BUF_NR];
+static int buf_nr = 0, buf_idx = 0;
+static bool log_end = false;
+static uint64_t nr_event = 0;
+static volatile sig_atomic_t async_pending = 0;
+
+static const char *ev_name[NR_REPLAY_EV] = {
+  [REPLAY_EV_RTC] = "rtc", [REPLAY_EV_KEYBOARD] = "keyboard",
+  [REPLAY_EV_INTR] = "intr", [REPLAY_EV_QUIT] = "quit",
+  [REPLAY_EV_AUDIO] = "audio",
+  [REPLAY_EV_SERIAL] = "serial",
+  [REPLAY_EV_NET] = "net", [REPLAY_EV_NET_POLL] = "net-poll",
+};
+
+static void replay_flush() {
+  if (replay_mode == REPLAY_RECORD && buf_nr > 0) {
+    size_t ret = fwrite(buf, sizeof(replay_rec), buf_nr, replay_fp);
+    Assert(ret == buf_nr, "replay: write error");
+    fflush(replay_fp);
+  }
+  buf_nr = 0;
+}
+
+static void replay_close() {
+  if (replay_mode == REPLAY_RECORD) {
+    replay_flush();
+    Log("%" PRIu64 " device events are recorded", nr_event);
+  }
+  if (replay_fp) fclose(replay_fp);
+  replay_fp = NULL;
+}
+
+static void log_event(int ev, uint64_t value) {
+  buf[buf_nr ++] = (replay_rec) { .icount = g_nr_guest_inst, .ev = ev, .value = value };
+  nr_event ++;
+  if (buf_nr == REPLAY_BUF_NR) replay_flush();
+}
+
+// return the next event in the log, or NULL at the end of the log
+static replay_rec *peek_event() {
+  if (buf_idx == buf_nr) {
+    if (log_end) return NULL;
+    buf_nr = fread(buf, sizeof(replay_rec), REPLAY_BUF_NR, replay_fp);
+    buf_idx = 0;
+    if (buf_nr == 0) { log_end = true; return NULL; }
+  }
+  return &buf[buf_idx];
+}
+
+uint64_t replay_record(int ev, uint64_t value) {
+  if (replay_mode == REPLAY_RECORD) log_event(ev, value);
+  return value;
+}
+
+uint64_t replay_fetch(int ev) {
+  replay_rec *r = peek_event();
+  if (r == NULL || r->ev != ev || r->icount != g_nr_guest_inst) {
+    panic("replay diverges at instruction %" PRIu64 ": guest reads %s, but the log has %s at instruction %" PRIu64,
+        g_nr_guest_inst, ev_name[ev], r ? ev_name[r->ev] : "nothing", r ? r->icount : 0);
+  }
+  buf_idx ++;
+  nr_event ++;
+  return r->value;
+}
+
+// may be called in signal handlers
+void replay_async_event(int ev) {
+  async_pending |= 1 << ev;
+  event_kick();
+}
+
+static void deliver(int ev) {
+  switch (ev) {
+    case REPLAY_EV_INTR: {
+      extern void dev_inject_intr();
+      dev_inject_intr();
+      break;
+    }
+    case REPLAY_EV_QUIT: nemu_state.state = NEMU_QUIT; break;
+#ifdef CONFIG_HAS_NET
+    case REPLAY_EV_NET_POLL: {
+      extern void net_poll_rx();
+      net_poll_rx();
+      break;
+    }
+#endif
+    default: panic("replay: %s is not an asynchronous event", ev_name[ev]);
+  }
+}
+
+static event_t play_ev;
+
+// called by device_update() when recording, and as `play_ev` when replaying
+void replay_update() {
+  if (replay_mode == REPLAY_RECORD) {
+    if (likely(async_pending == 0)) return;
+    int pending = async_pending;
+    async_pending = 0;
+    for (int ev = 0; ev < NR_REPLAY_EV; ev ++) {
+      if (pending & (1 << ev)) {
+        log_event(ev, 0);
+        deliver(ev);
+      }
+    }
+  } else if (replay_mode == REPLAY_PLAY) {
+    replay_rec *r;
+    while ((r = peek_event()) != NULL && r->icount == g_nr_guest_inst &&
+        (r->ev == REPLAY_EV_INTR || r->ev == REPLAY_EV_QUIT || r->ev == REPLAY_EV_NET_POLL)) {
+      buf_idx ++;
+      nr_event ++;
+      deliver(r->ev);
+    }
+    // a record of this instruction count is read by the next instruction
+    if (r != NULL) event_schedule(&play_ev, r->icount > g_nr_guest_inst ? r->icount : g_nr_guest_inst + 1);
+  }
+}
+
+void init_replay(const char *record_file, const char *replay_file) {
+  Assert(record_file == NULL || replay_file == NULL, "Can not record and replay at the same time");
+  if (record_file == NULL && replay_file == NULL) return;
+
+  char magic[8];
+  if (record_file != NULL) {
+    replay_fp = fopen(record_file, "wb");
+    Assert(replay_fp, "Can not open '%s'", record_file);
+    fwrite(REPLAY_MAGIC, sizeof(magic), 1, replay_fp);
+    replay_mode = REPLAY_RECORD;
+    Log("Device input is recorded to %s", record_file);
+  } else {
+    replay_fp = fopen(replay_file, "rb");
+    Assert(replay_fp, "Can not open '%s'", replay_file);
+    int ret = fread(magic, sizeof(magic), 1, replay_fp);
+    Assert(ret == 1 && memcmp(magic, REPLAY_MAGIC, sizeof(magic)) == 0,
+        "'%s' is not a device input log", replay_file);
+    replay_mode = REPLAY_PLAY;
+    Log("Device input is replayed from %s", replay_file);
+    event_init(&play_ev, "replay", EVENT_ICOUNT, replay_update);
+    event_schedule(&play_ev, 0);
+  }
+  atexit(replay_close);
+}
@@ -14,6 +14,11 @@
 ***************************************************************************************/
 
 #include <device/map.h>
+#include <memory/paddr.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "mmc.h"
 
 // http://www.files.e-shop.co.il/pdastore/Tech-mmc-samsung/SEC%20MMC%20SPEC%20ver09.pdf
@@ -28,8 +33,15 @@
 #define C_SIZE (NR_BLOCK / MULT - 1)
 
 // This is a simple hardware implementation of linux/drivers/mmc/host/bcm2835.c
-// No DMA and IRQ is supported, so the driver must be modified to start PIO
+// No IRQ is supported, so the driver must be modified to start PIO
 // right after sending the actual read/write commands.
+// The image is mapped into NEMU, so PIO through SDDATA is a copy of 4 bytes
+// instead of a call to stdio.
+//
+// With SDCARD_DMA, SDDMA is a NEMU-specific register: if the driver writes a guest
+// physical address to it before a multiple block command, the `blkcnt` blocks set
+// by MMC_SET_BLOCK_COUNT are copied between the image and the guest memory during
+// the command, and SDDMA is cleared on completion. PIO is used while SDDMA is 0.
 
 enum {
   SDCMD, SDARG, SDTOUT, SDCDIV,
@@ -37,10 +49,11 @@ enum {
   SDHSTS, __PAD0, __PAD1, __PAD2,
   SDVDD, SDEDM, SDHCFG, SDHBCT,
   SDDATA, __PAD10, __PAD11, __PAD12,
-  SDHBLC
+  SDHBLC, SDDMA
 };
 
-static FILE *fp = NULL;
+static uint8_t *img = NULL;
+static uint64_t img_size = 0;
 static uint32_t *base = NULL;
 static uint32_t blkcnt = 0;
 static long blk_addr = 0;
@@ -48,11 +61,35 @@ static uint32_t addr = 0;
 static bool write_cmd = 0;
 static bool read_ext_csd = false;
 
+// the image outside its size reads as 0 and drops the writes
+static uint8_t *img_at(uint64_t off, uint64_t len) {
+  return (img && off + len <= img_size) ? img + off : NULL;
+}
+
+#ifdef CONFIG_SDCARD_DMA
+static void sdcard_dma() {
+  paddr_t buf = base[SDDMA];
+  uint64_t len = (uint64_t)blkcnt << 9;
+  uint8_t *p = img_at((uint64_t)blk_addr << 9, len);
+  base[SDDMA] = 0;
+  if (len == 0) return;
+  if (p == NULL || !in_pmem(buf) || !in_pmem(buf + len - 1) || buf + len - 1 < buf) {
+    Log("sdcard: invalid DMA of %u blocks from block %ld at " FMT_PADDR, blkcnt, blk_addr, buf);
+    return;
+  }
+  if (write_cmd) memcpy(p, guest_to_host(buf), len);
+  else {
+    memcpy(guest_to_host(buf), p, len);
+    difftest_dma(buf, len);
+  }
+}
+#endif
+
 static void prepare_rw(int is_write) {
   blk_addr = base[SDARG];
   addr = 0;
-  if (fp) fseek(fp, blk_addr << 9, SEEK_SET);
   write_cmd = is_write;
+  IFDEF(CONFIG_SDCARD_DMA, if (base[SDDMA] != 0) sdcard_dma());
 }
 
 static void sdcard_handle_cmd(int cmd) {
@@ -93,6 +130,7 @@ static void sdcard_io_handler(uint32_t offset, int len, bool is_write) {
   switch (idx) {
     case SDCMD: sdcard_handle_cmd(base[SDCMD] & 0x3f); break;
     case SDARG:
+    case SDDMA:
     case SDRSP0:
     case SDRSP1:
     case SDRSP2:
@@ -109,10 +147,10 @@ static void sdcard_io_handler(uint32_t offset, int len, bool is_write) {
          }
          base[SDDATA] = data;
          if (addr == 512 - 4) read_ext_csd = false;
-       } else if (fp) {
-         __attribute__((unused)) int ret;
-         if (!write_cmd) { ret = fread(&base[SDDATA], 4, 1, fp); }
-         else { ret = fwrite(&base[SDDATA], 4, 1, fp); }
+       } else {
+         uint8_t *p = img_at(((uint64_t)blk_addr << 9) + addr, 4);
+         if (!write_cmd) { base[SDDATA] = p ? *(uint32_t *)p : 0; }
+         else if (p) { *(uint32_t *)p = base[SDDATA]; }
        }
        addr += 4;
        break;
@@ -128,7 +166,19 @@ void init_sdcard() {
 
   Assert(C_SIZE < (1 << 12), "shoule be fit in 12 bits");
 
-  const char *img = CONFIG_SDCARD_IMG_PATH;
-  fp = fopen(img, "r+");
-  if (fp == NULL) Log("Can not find sdcard image: %s", img);
+  const char *path = CONFIG_SDCARD_IMG_PATH;
+  int fd = open(path, O_RDWR);
+  if (fd < 0) {
+    Log("Can not find sdcard image: %s", path);
+    return;
+  }
+  struct stat st;
+  Assert(fstat(fd, &st) == 0, "Can not get the size of sdcard image %s", path);
+  img_size = st.st_size;
+  if (img_size > 0) {
+    // the writes of the guest go into the image
+    img = mmap(NULL, img_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    Assert(img != MAP_FAILED, "Can not map sdcard image %s", path);
+  }
+  close(fd);
 }
@@ -13,39 +13,184 @@
 * See the Mulan PSL v2 for more details.
 ***************************************************************************************/
 
+
 #include <utils.h>
 #include <device/map.h>
+#include <device/intr.h>
+#include <device/replay.h>
+#ifndef CONFIG_TARGET_AM
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 /* http://en.wikibooks.org/wiki/Serial_Programming/8250_UART_Programming */
 // NOTE: this is compatible to 16550
 
-#define CH_OFFSET 0
+enum {
+  CH_OFFSET,  // RBR (read), THR (write), DLL (DLAB = 1)
+  IER_OFFSET, // DLM (DLAB = 1)
+  IIR_OFFSET, // IIR (read), FCR (write)
+  LCR_OFFSET,
+  MCR_OFFSET,
+  LSR_OFFSET,
+  MSR_OFFSET,
+  SCR_OFFSET,
+  NR_OFFSET
+};
+
+#define IER_RDI  0x01 // received data available interrupt
+#define LCR_DLAB 0x80
+#define LSR_DR   0x01 // data ready
+#define LSR_THRE 0x20 // transmitter holding register empty
+#define LSR_TEMT 0x40 // transmitter empty
+#define IIR_NO_INT 0x01
+#define IIR_RDI    0x04
+#define IIR_FIFO   0xc0
 
 static uint8_t *serial_base = NULL;
+static uint8_t ier = 0, fcr = 0, dll = 0, dlm = 0;
+static bool rx_irq = false; // the line to the PLIC
+
+/*
+The output is kept in a buffer and written to the host stderr with one call on
+a newline, when the buffer is full, when the device is idle for a frame of the
+timer, and at exit, instead of one call per character.
+
+The input comes from a file, a pipe or stdin given by --serial-in, or from the
+FIFO /tmp/nemu.serial with SERIAL_INPUT_FIFO. It is read without blocking into
+a ring at every frame of the timer and whenever the guest takes the last byte
+of the ring, so polling LSR costs no system call. The values read from RBR and
+LSR are device input for replay. With IER_RDI set, the line to the PLIC is high
+while there is data in the ring. New data found in a frame asks for the line to
+be checked again with dev_raise_intr(), so that the check is replayed as well.
+*/
+#ifndef CONFIG_TARGET_AM
+#define TX_BUF_SIZE 4096
+#define RX_BUF_SIZE 4096
+
+static char tx_buf[TX_BUF_SIZE];
+static int tx_nr = 0;
+static bool tx_busy = false; // the guest has written since the last frame
+
+void serial_flush() {
+  int off = 0;
+  while (off < tx_nr) {
+    int ret = write(STDERR_FILENO, tx_buf + off, tx_nr - off);
+    if (ret <= 0) break;
+    off += ret;
+  }
+  tx_nr = 0;
+}
+
+static uint8_t rx_buf[RX_BUF_SIZE];
+static int rx_head = 0, rx_tail = 0;
+static int rx_fd = -1;
+
+static void rx_fill() {
+  if (rx_fd < 0 || rx_head != rx_tail) return;
+  int ret = read(rx_fd, rx_buf, RX_BUF_SIZE);
+  rx_head = 0;
+  rx_tail = ret > 0 ? ret : 0;
+}
+
+static uint8_t serial_lsr() {
+  return LSR_THRE | LSR_TEMT | (rx_head != rx_tail ? LSR_DR : 0);
+}
+
+static uint8_t serial_getc() {
+  if (rx_head == rx_tail) return 0;
+  uint8_t ch = rx_buf[rx_head ++];
+  rx_fill();
+  return ch;
+}
 
+void serial_update_irq() {
+  rx_irq = (ier & IER_RDI) && (REPLAY_INPUT(REPLAY_EV_SERIAL, serial_lsr()) & LSR_DR);
+  dev_set_irq(IRQ_SERIAL, rx_irq);
+}
+
+void serial_update() {
+  if (!tx_busy) serial_flush();
+  tx_busy = false;
+  rx_fill();
+  if ((ier & IER_RDI) && !rx_irq && rx_head != rx_tail) dev_raise_intr();
+}
+
+void init_serial_input(const char *path) {
+  if (path == NULL) {
+#ifdef CONFIG_SERIAL_INPUT_FIFO
+    path = "/tmp/nemu.serial";
+    if (access(path, F_OK) != 0) Assert(mkfifo(path, 0666) == 0, "Can not create %s", path);
+#else
+    return;
+#endif
+  }
+  rx_fd = strcmp(path, "-") == 0 ? STDIN_FILENO : open(path, O_RDONLY | O_NONBLOCK);
+  Assert(rx_fd >= 0, "Can not open serial input %s", path);
+  fcntl(rx_fd, F_SETFL, fcntl(rx_fd, F_GETFL) | O_NONBLOCK);
+  Log("Serial input is read from %s", strcmp(path, "-") == 0 ? "stdin" : path);
+  rx_fill();
+}
+#endif
 
 static void serial_putc(char ch) {
-  MUXDEF(CONFIG_TARGET_AM, putch(ch), putc(ch, stderr));
+#ifdef CONFIG_TARGET_AM
+  putch(ch);
+#else
+  tx_buf[tx_nr ++] = ch;
+  tx_busy = true;
+  if (ch == '\n' || tx_nr == TX_BUF_SIZE) serial_flush();
+#endif
 }
 
 static void serial_io_handler(uint32_t offset, int len, bool is_write) {
   assert(len == 1);
+  bool dlab = serial_base[LCR_OFFSET] & LCR_DLAB;
   switch (offset) {
     /* We bind the serial port with the host stderr in NEMU. */
     case CH_OFFSET:
-      if (is_write) serial_putc(serial_base[0]);
-      else panic("do not support read");
+      if (dlab) {
+        if (is_write) dll = serial_base[CH_OFFSET];
+        else serial_base[CH_OFFSET] = dll;
+      } else if (is_write) serial_putc(serial_base[CH_OFFSET]);
+      else {
+        serial_base[CH_OFFSET] = REPLAY_INPUT(REPLAY_EV_SERIAL,
+            MUXDEF(CONFIG_TARGET_AM, 0, serial_getc()));
+        IFNDEF(CONFIG_TARGET_AM, if (rx_irq) serial_update_irq());
+      }
+      break;
+    case IER_OFFSET:
+      if (dlab) {
+        if (is_write) dlm = serial_base[IER_OFFSET];
+        else serial_base[IER_OFFSET] = dlm;
+      } else if (is_write) {
+        ier = serial_base[IER_OFFSET] & 0xf;
+        IFNDEF(CONFIG_TARGET_AM, serial_update_irq());
+      } else serial_base[IER_OFFSET] = ier;
       break;
+    case IIR_OFFSET:
+      if (is_write) fcr = serial_base[IIR_OFFSET];
+      else serial_base[IIR_OFFSET] = (rx_irq ? IIR_RDI : IIR_NO_INT) | ((fcr & 0x1) ? IIR_FIFO : 0);
+      break;
+    case LSR_OFFSET:
+      if (!is_write) serial_base[LSR_OFFSET] = REPLAY_INPUT(REPLAY_EV_SERIAL,
+          MUXDEF(CONFIG_TARGET_AM, LSR_THRE | LSR_TEMT, serial_lsr()));
+      break;
+    case MSR_OFFSET:
+      if (!is_write) serial_base[MSR_OFFSET] = 0;
+      break;
+    case LCR_OFFSET: case MCR_OFFSET: case SCR_OFFSET: break;
     default: panic("do not support offset = %d", offset);
   }
 }
 
 void init_serial() {
-  serial_base = new_space(8);
+  serial_base = new_space(NR_OFFSET);
 #ifdef CONFIG_HAS_PORT_IO
-  add_pio_map ("serial", CONFIG_SERIAL_PORT, serial_base, 8, serial_io_handler);
+  add_pio_map ("serial", CONFIG_SERIAL_PORT, serial_base, NR_OFFSET, serial_io_handler);
 #else
-  add_mmio_map("serial", CONFIG_SERIAL_MMIO, serial_base, 8, serial_io_handler);
+  add_mmio_map("serial", CONFIG_SERIAL_MMIO, serial_base, NR_OFFSET, serial_io_handler);
 #endif
-
+  IFNDEF(CONFIG_TARGET_AM, atexit(serial_flush));
 }
@@ -15,6 +15,7 @@
 
 #include <common.h>
 #include <device/map.h>
+#include <device/replay.h>
 
 #define SCREEN_W (MUXDEF(CONFIG_VGA_SIZE_800x600, 800, 400))
 #define SCREEN_H (MUXDEF(CONFIG_VGA_SIZE_800x600, 600, 300))
@@ -34,8 +35,94 @@ static uint32_t screen_size() {
 static void *vmem = NULL;
 static uint32_t *vgactl_port_base = NULL;
 
-#ifdef CONFIG_VGA_SHOW_SCREEN
-#ifndef CONFIG_TARGET_AM
+// the synced frames go to a window, or are hashed by the headless backend
+#if defined(CONFIG_VGA_SHOW_SCREEN) || defined(CONFIG_HEADLESS)
+#define VGA_OUTPUT 1
+#endif
+
+#ifdef VGA_OUTPUT
+#if defined(CONFIG_HEADLESS)
+#include <device/alarm.h>
+
+/*
+Headless screen: every synced frame is hashed instead of shown. The hash of a
+row is only recomputed when the row is dirty. With --frame-dir=DIR, the hashes
+are written to DIR/frames.txt, and with --frame-every=N, every N-th frame is
+written to DIR/frame-<index>.ppm.
+*/
+static uint64_t row_hash[SCREEN_H] = {};
+static uint64_t nr_frame = 0;
+static uint64_t guest_start = 0, host_start = 0;
+static const char *frame_dir = NULL;
+static int frame_every = 0;
+static FILE *frame_fp = NULL;
+
+static uint64_t guest_time() {
+  return MUXDEF(CONFIG_TIMER_ICOUNT, icount_time(), get_time());
+}
+
+void init_frame_dump(const char *dir, int every) {
+  frame_dir = dir;
+  frame_every = every;
+}
+
+static void dump_ppm(uint64_t idx) {
+  char path[512];
+  snprintf(path, sizeof(path), "%s/frame-%06" PRIu64 ".ppm", frame_dir, idx);
+  FILE *fp = fopen(path, "wb");
+  Assert(fp, "Can not open '%s'", path);
+  fprintf(fp, "P6\n%d %d\n255\n", SCREEN_W, SCREEN_H);
+  uint8_t row[SCREEN_W * 3];
+  for (int y = 0; y < SCREEN_H; y ++) {
+    uint32_t *p = (uint32_t *)vmem + y * SCREEN_W;
+    for (int x = 0; x < SCREEN_W; x ++) {
+      row[x * 3 + 0] = p[x] >> 16;
+      row[x * 3 + 1] = p[x] >> 8;
+      row[x * 3 + 2] = p[x];
+    }
+    fwrite(row, sizeof(row), 1, fp);
+  }
+  fclose(fp);
+}
+
+static void frame_statistic() {
+  uint64_t guest_us = guest_time() - guest_start, host_us = get_time() - host_start;
+  Log("VGA: %" PRIu64 " frames, %.2f per guest second, %.2f per host second", nr_frame,
+      guest_us ? nr_frame * 1e6 / guest_us : 0.0, host_us ? nr_frame * 1e6 / host_us : 0.0);
+  if (frame_fp) fclose(frame_fp);
+}
+
+static void init_screen() {
+  guest_start = guest_time();
+  host_start = get_time();
+  if (frame_dir != NULL) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/frames.txt", frame_dir);
+    frame_fp = fopen(path, "w");
+    Assert(frame_fp, "Can not open '%s'", path);
+    Log("The hashes of the frames are written to %s", path);
+  }
+  atexit(frame_statistic);
+}
+
+static inline void update_rows(int y, int h) {
+  for (; h > 0; y ++, h --) {
+    uint32_t *p = (uint32_t *)vmem + y * SCREEN_W;
+    uint64_t hash = 0xcbf29ce484222325ull; // FNV-1a over the pixels
+    for (int x = 0; x < SCREEN_W; x ++) hash = (hash ^ p[x]) * 0x100000001b3ull;
+    row_hash[y] = hash;
+  }
+}
+
+static inline void present_screen(bool changed) {
+  uint64_t hash = 0xcbf29ce484222325ull;
+  for (int y = 0; y < SCREEN_H; y ++) hash = (hash ^ row_hash[y]) * 0x100000001b3ull;
+  if (frame_fp) fprintf(frame_fp, "%" PRIu64 " %" PRIu64 " %016" PRIx64 "\n",
+      nr_frame, guest_time() - guest_start, hash);
+  if (frame_dir != NULL && frame_every > 0 && nr_frame % frame_every == 0) dump_ppm(nr_frame);
+  nr_frame ++;
+}
+#elif !defined(CONFIG_TARGET_AM)
 #include <SDL2/SDL.h>
 
 static SDL_Renderer *renderer = NULL;
@@ -56,8 +143,13 @@ static void init_screen() {
   SDL_RenderPresent(renderer);
 }
 
-static inline void update_screen() {
-  SDL_UpdateTexture(texture, NULL, vmem, SCREEN_W * sizeof(uint32_t));
+static inline void update_rows(int y, int h) {
+  SDL_Rect rect = { .x = 0, .y = y, .w = SCREEN_W, .h = h };
+  SDL_UpdateTexture(texture, &rect, (uint32_t *)vmem + y * SCREEN_W, SCREEN_W * sizeof(uint32_t));
+}
+
+static inline void present_screen(bool changed) {
+  if (!changed) return;
   SDL_RenderClear(renderer);
   SDL_RenderCopy(renderer, texture, NULL, NULL);
   SDL_RenderPresent(renderer);
@@ -65,28 +157,107 @@ static inline void update_screen() {
 #else
 static void init_screen() {}
 
-static inline void update_screen() {
-  io_write(AM_GPU_FBDRAW, 0, 0, vmem, screen_width(), screen_height(), true);
+static inline void update_rows(int y, int h) {
+  uint32_t w = screen_width();
+  io_write(AM_GPU_FBDRAW, 0, y, (uint32_t *)vmem + y * w, w, h, false);
+}
+
+static inline void present_screen(bool changed) {
+  if (changed) io_write(AM_GPU_FBDRAW, 0, 0, NULL, 0, 0, true);
+}
+#endif
+
+/*
+The rows of vmem written since the last sync. Only they are uploaded to the
+screen at the next sync, and nothing is uploaded if the guest has not drawn.
+*/
+static bool *row_dirty = NULL;
+static uint32_t dirty_nr = 0;
+static uint32_t row_bytes = 0;
+
+static inline void mark_row(uint32_t row) {
+  if (!row_dirty[row]) {
+    row_dirty[row] = true;
+    dirty_nr ++;
+  }
+}
+
+static void vmem_io_handler(uint32_t offset, int len, bool is_write) {
+  if (!is_write) return;
+  mark_row(offset / row_bytes);
+  mark_row((offset + len - 1) / row_bytes);
+}
+
+static void update_screen() {
+  bool changed = dirty_nr > 0;
+  int h = screen_height();
+  for (int y = 0; changed && y < h; ) {
+    if (!row_dirty[y]) { y ++; continue; }
+    int y0 = y;
+    for (; y < h && row_dirty[y]; y ++) row_dirty[y] = false;
+    update_rows(y0, y - y0);
+  }
+  dirty_nr = 0;
+  present_screen(changed);
+}
+
+static void init_dirty() {
+  row_bytes = screen_width() * sizeof(uint32_t);
+  row_dirty = malloc(screen_height());
+  assert(row_dirty);
+  // the first frame is uploaded as a whole
+  for (int y = 0; y < screen_height(); y ++) mark_row(y);
 }
 #endif
+
+uint32_t *vga_vmem() {
+  return vmem;
+}
+
+void vga_screen_size(int *w, int *h) {
+  *w = screen_width();
+  *h = screen_height();
+}
+
+// the rows [y, y + h) are drawn by the accelerator instead of the guest
+void vga_mark_rows(int y, int h) {
+#ifdef VGA_OUTPUT
+  for (; h > 0; y ++, h --) mark_row(y);
 #endif
+}
 
 void vga_update_screen() {
-  // TODO: call `update_screen()` when the sync register is non-zero,
-  // then zero out the sync register
+  if (vgactl_port_base[1] == 0) return;
+  vgactl_port_base[1] = 0;
+  IFDEF(VGA_OUTPUT, update_screen());
 }
 
+#ifdef CONFIG_HEADLESS
+// every sync of the guest is a frame, independent of the host speed and the
+// frame rate of the timer, and also when replaying
+static void vgactl_io_handler(uint32_t offset, int len, bool is_write) {
+  if (is_write && offset == 4) vga_update_screen();
+}
+#endif
+
 void init_vga() {
-  vgactl_port_base = (uint32_t *)new_space(8);
+  // screen size, sync, and the size of the GPU memory, 0 without the accelerator
+  vgactl_port_base = (uint32_t *)new_space(12);
   vgactl_port_base[0] = (screen_width() << 16) | screen_height();
+  vgactl_port_base[2] = MUXDEF(CONFIG_VGA_ACCEL, CONFIG_GPU_MEM_SIZE, 0);
 #ifdef CONFIG_HAS_PORT_IO
-  add_pio_map ("vgactl", CONFIG_VGA_CTL_PORT, vgactl_port_base, 8, NULL);
+  add_pio_map ("vgactl", CONFIG_VGA_CTL_PORT, vgactl_port_base, 12,
+      MUXDEF(CONFIG_HEADLESS, vgactl_io_handler, NULL));
 #else
-  add_mmio_map("vgactl", CONFIG_VGA_CTL_MMIO, vgactl_port_base, 8, NULL);
+  add_mmio_map("vgactl", CONFIG_VGA_CTL_MMIO, vgactl_port_base, 12,
+      MUXDEF(CONFIG_HEADLESS, vgactl_io_handler, NULL));
 #endif
 
   vmem = new_space(screen_size());
-  add_mmio_map("vmem", CONFIG_FB_ADDR, vmem, screen_size(), NULL);
-  IFDEF(CONFIG_VGA_SHOW_SCREEN, init_screen());
-  IFDEF(CONFIG_VGA_SHOW_SCREEN, memset(vmem, 0, screen_size()));
+  add_mmio_map("vmem", CONFIG_FB_ADDR, vmem, screen_size(),
+      MUXDEF(VGA_OUTPUT, vmem_io_handler, NULL));
+  // no window is opened when replaying
+  IFDEF(VGA_OUTPUT, if (!replay_playing() || ISDEF(CONFIG_HEADLESS)) init_screen());
+  IFDEF(VGA_OUTPUT, memset(vmem, 0, screen_size()));
+  IFDEF(VGA_OUTPUT, init_dirty());
 }
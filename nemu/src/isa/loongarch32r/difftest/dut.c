@@ -21,5 +21,13 @@ bool isa_difftest_checkregs(CPU_state *ref_r, vaddr_t pc) {
   return false;
 }
 
+uint64_t isa_difftest_dirty_mask(struct Decode *s) {
+  return DIFFTEST_REG_ALL;
+}
+
+const char *isa_difftest_reg_name(int idx) {
+  return idx < ARRLEN(cpu.gpr) ? reg_name(idx) : "pc";
+}
+
 void isa_difftest_attach() {
 }
@@ -21,5 +21,14 @@ bool isa_difftest_checkregs(CPU_state *ref_r, vaddr_t pc) {
   return false;
 }
 
+uint64_t isa_difftest_dirty_mask(struct Decode *s) {
+  return DIFFTEST_REG_ALL;
+}
+
+const char *isa_difftest_reg_name(int idx) {
+  static const char *names[] = { "status", "lo", "hi", "badvaddr", "cause", "pc" };
+  return idx < ARRLEN(cpu.gpr) ? reg_name(idx) : names[idx - ARRLEN(cpu.gpr)];
+}
+
 void isa_difftest_attach() {
 }
@@ -32,5 +32,6 @@ typedef struct {
 } mips32_ISADecodeInfo;
 
 #define isa_mmu_check(vaddr, len, type) (MMU_DIRECT)
+#define isa_intr_pending() false
 
 #endif
@@ -15,10 +15,50 @@
 
 #include <isa.h>
 #include <cpu/difftest.h>
+#include <cpu/decode.h>
 #include "../local-include/reg.h"
 
 bool isa_difftest_checkregs(CPU_state *ref_r, vaddr_t pc) {
-  return false;
+  bool ok = true;
+  for (int i = 0; i < ARRLEN(cpu.gpr); i ++) {
+    ok &= difftest_check_reg(reg_name(i), pc, ref_r->gpr[i], gpr(i));
+  }
+  ok &= difftest_check_reg("pc", pc, ref_r->pc, cpu.pc);
+  ok &= difftest_check_reg("mstatus", pc, ref_r->csr.mstatus, cpu.csr.mstatus);
+  ok &= difftest_check_reg("mepc", pc, ref_r->csr.mepc, cpu.csr.mepc);
+  ok &= difftest_check_reg("mcause", pc, ref_r->csr.mcause, cpu.csr.mcause);
+  ok &= difftest_check_reg("mtvec", pc, ref_r->csr.mtvec, cpu.csr.mtvec);
+  ok &= difftest_check_reg("satp", pc, ref_r->csr.satp, cpu.csr.satp);
+  ok &= difftest_check_reg("mie", pc, ref_r->csr.mie, cpu.csr.mie);
+  return ok;
+}
+
+// all instructions writing a GPR have rd in inst[11:7], and the others leave
+// that register unchanged, so it is always safe to report it
+int isa_difftest_commit_reg(struct Decode *s) {
+  return BITS(s->isa.inst.val, 11, 7);
+}
+
+#define REG_IDX(p) ((word_t *)(p) - (word_t *)&cpu)
+
+// rd and pc, plus the CSR of a CSR instruction, or all CSRs for ecall and mret
+uint64_t isa_difftest_dirty_mask(struct Decode *s) {
+  uint32_t i = s->isa.inst.val;
+  uint64_t mask = (1ull << BITS(i, 11, 7)) | (1ull << REG_IDX(&cpu.pc));
+  if (BITS(i, 6, 0) == 0x73) {
+    if (BITS(i, 14, 12) == 0) return mask | (DIFFTEST_REG_ALL & ~DIFFTEST_REG_NO_CSR);
+    word_t *csr = csr_ptr(BITS(i, 31, 20));
+    // mip is not transferred, and is not in `cpu`
+    if (csr != NULL && csr != &g_mip) mask |= 1ull << REG_IDX(csr);
+  }
+  return mask;
+}
+
+const char *isa_difftest_reg_name(int idx) {
+  static const char *csr_names[] = { "mstatus", "mepc", "mcause", "mtvec", "satp", "mie" };
+  if (idx < ARRLEN(cpu.gpr)) return reg_name(idx);
+  if (idx == REG_IDX(&cpu.pc)) return "pc";
+  return csr_names[idx - REG_IDX(&cpu.csr)];
 }
 
 void isa_difftest_attach() {
@@ -21,6 +21,10 @@
 typedef struct {
   word_t gpr[MUXDEF(CONFIG_RVE, 16, 32)];
   vaddr_t pc;
+  // machine mode only, in the order of difftest
+  struct {
+    word_t mstatus, mepc, mcause, mtvec, satp, mie;
+  } csr;
 } MUXDEF(CONFIG_RV64, riscv64_CPU_state, riscv32_CPU_state);
 
 // decode
@@ -32,4 +36,11 @@ typedef struct {
 
 #define isa_mmu_check(vaddr, len, type) (MMU_DIRECT)
 
+// the interrupts of M mode, also their bits in mip and mie
+enum { INTR_M_SOFT = 3, INTR_M_TIMER = 7, INTR_M_EXT = 11 };
+
+// mip is driven by the devices, so it is not a part of the state compared by difftest
+extern word_t g_mip;
+#define isa_intr_pending() ((g_mip & cpu.csr.mie) != 0)
+
 #endif
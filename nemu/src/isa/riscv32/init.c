@@ -32,6 +32,9 @@ static void restart() {
 
   /* The zero register is always 0. */
   cpu.gpr[0] = 0;
+
+  /* The hart runs in M mode. */
+  cpu.csr.mstatus = 0x1800;
 }
 
 void init_isa() {
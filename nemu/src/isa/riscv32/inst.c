@@ -17,6 +17,7 @@
 #include <cpu/cpu.h>
 #include <cpu/ifetch.h>
 #include <cpu/decode.h>
+#include <cpu/difftest.h>
 #include <trace.h>
 
 #define R(i) gpr(i)
@@ -136,6 +137,83 @@ static void decode_operand(Decode *s, int *rd, word_t *src1, word_t *src2, word_
   }
 }
 
+/*
+Zicsr: CSRRW, CSRRS and CSRRC read the old value of the CSR into rd, then write rs1 to
+the CSR, set or clear the bits of rs1 in the CSR, respectively.
+The CSR??I variants take the 5-bit zero-extended immediate in the rs1 field instead.
+*/
+enum
+{
+  CSR_W,
+  CSR_S,
+  CSR_C,
+};
+
+static void csr_op(Decode *s, int rd, word_t src, int op)
+{
+  word_t *csr = csr_ptr(BITS(s->isa.inst.val, 31, 20));
+  if (csr == NULL)
+  {
+    INV(s->pc);
+    return;
+  }
+  word_t old = *csr;
+  if (csr == &g_mip)
+  {
+    // the bits of mip are driven by the devices, and REF has none of them
+    difftest_skip_ref();
+    R(rd) = old;
+    return;
+  }
+  switch (op)
+  {
+  case CSR_W:
+    *csr = src;
+    break;
+  case CSR_S:
+    *csr = old | src;
+    break;
+  case CSR_C:
+    *csr = old & ~src;
+    break;
+  }
+  R(rd) = old;
+}
+
+#define zimm() BITS(s->isa.inst.val, 19, 15)
+
+/*
+MRET returns to mepc with MIE <- MPIE, MPIE <- 1 and MPP <- U (the least-privileged mode, as Spike does).
+NEMU itself always stays in M mode.
+*/
+static vaddr_t mret()
+{
+  word_t mstatus = cpu.csr.mstatus;
+  mstatus = (mstatus & ~(MSTATUS_MIE | MSTATUS_MPP)) | MSTATUS_MPIE |
+            ((mstatus & MSTATUS_MPIE) ? MSTATUS_MIE : 0);
+  cpu.csr.mstatus = mstatus;
+  return cpu.csr.mepc;
+}
+
+/*
+WFI stays at itself until an interrupt is pending in mip and enabled in mie, regardless of
+mstatus.MIE. The devices are asked to idle meanwhile, so an idle guest does not keep the
+host busy. If the interrupt is taken, mepc is the instruction after WFI, see isa_query_intr().
+REF never executes it, since its devices do not drive its mip.
+*/
+static vaddr_t wfi(Decode *s)
+{
+  difftest_skip_ref();
+  wfi_stall = !isa_intr_pending();
+  if (!wfi_stall)
+    return s->snpc;
+#ifdef CONFIG_DEVICE
+  void dev_idle();
+  dev_idle();
+#endif
+  return s->pc;
+}
+
 static int decode_exec(Decode *s)
 {
 // #define DEBUG_DDDD
@@ -172,7 +250,7 @@ static int decode_exec(Decode *s)
   Plain unconditional jumps (assembler pseudoinstruction J) are encoded as a JAL with rd=x0 (x0 is the first gpr $0).
   Note that $zero is reset to zero at the end of decode_exec()... so J can be pattern matched and implemented by JAL.
   */
-  INSTPAT("??????? ????? ????? ??? ????? 11011 11", jal, J, s->dnpc = s->pc + imm; R(rd) = s->pc + 4; ftrace_call(s->pc, s->dnpc)); /*jump and link*/
+  INSTPAT("??????? ????? ????? ??? ????? 11011 11", jal, J, s->dnpc = s->pc + imm; R(rd) = s->pc + 4; ftrace_call(s->pc, s->dnpc, rd)); /*jump and link*/
 
   /*
   ret is a pseudoinstruction, which is expanded to jalr x0, 0(x1)
@@ -185,7 +263,7 @@ static int decode_exec(Decode *s)
   INSTPAT("??????? ????? ????? 000 ????? 11001 11", jalr /*jump and link register*/, I,
           s->dnpc = (src1 + imm) & (((1ull << (32)) - 1) - 1); /*#define BITMASK(bits) ((1ull << (bits)) - 1); set the least-significant bit of the result to zero*/
           R(rd) = s->pc + 4;
-          ftrace_call(s->pc, s->dnpc));
+          ftrace_call(s->pc, s->dnpc, rd));
   /*
    All branch instructions use the B-type instruction format.
    The 12-bit B-immediate encodes signed offsets in multiples of 2 bytes. The offset is sign-extended and added to the address of the branch
@@ -285,7 +363,16 @@ static int decode_exec(Decode *s)
   INSTPAT("0000001 ????? ????? 110 ????? 01100 11", rem, R, R(rd) = (int32_t)src1 % (int32_t)src2);
   INSTPAT("0000001 ????? ????? 111 ????? 01100 11", remu, R, R(rd) = src1 % src2);
 
-  // INSTPAT("0000000 00000 00000 000 00000 11100 11", ecall, N, );
+  INSTPAT("??????? ????? ????? 001 ????? 11100 11", csrrw, I, csr_op(s, rd, src1, CSR_W));
+  INSTPAT("??????? ????? ????? 010 ????? 11100 11", csrrs, I, csr_op(s, rd, src1, CSR_S));
+  INSTPAT("??????? ????? ????? 011 ????? 11100 11", csrrc, I, csr_op(s, rd, src1, CSR_C));
+  INSTPAT("??????? ????? ????? 101 ????? 11100 11", csrrwi, I, csr_op(s, rd, zimm(), CSR_W));
+  INSTPAT("??????? ????? ????? 110 ????? 11100 11", csrrsi, I, csr_op(s, rd, zimm(), CSR_S));
+  INSTPAT("??????? ????? ????? 111 ????? 11100 11", csrrci, I, csr_op(s, rd, zimm(), CSR_C));
+
+  INSTPAT("0000000 00000 00000 000 00000 11100 11", ecall, N, s->dnpc = isa_raise_intr(11, s->pc)); // 11: environment call from M-mode
+  INSTPAT("0011000 00010 00000 000 00000 11100 11", mret, N, s->dnpc = mret());
+  INSTPAT("0001000 00101 00000 000 00000 11100 11", wfi, N, s->dnpc = wfi(s));
   INSTPAT("0000000 00001 00000 000 00000 11100 11", ebreak, N, NEMUTRAP(s->pc, R(10))); // R(10) is $a0
   /*
   在模式匹配过程的最后有一条inv的规则, 表示"若前面所有的模式匹配规则都无法成功匹配, 则将该指令视为非法指令
@@ -22,6 +22,20 @@ const char *regs[] = {
     "a6", "a7", "s2", "s3", "s4", "s5", "s6", "s7",
   "s8", "s9", "s10", "s11", "t3", "t4", "t5", "t6"};
 
+static const struct
+{
+  const char *name;
+  word_t *ptr;
+} csrs[] = {
+    {"mstatus", &cpu.csr.mstatus},
+    {"mepc", &cpu.csr.mepc},
+    {"mcause", &cpu.csr.mcause},
+    {"mtvec", &cpu.csr.mtvec},
+    {"satp", &cpu.csr.satp},
+    {"mie", &cpu.csr.mie},
+    {"mip", &g_mip},
+};
+
 void isa_reg_display()
 {
   int reg_cnt = ARRLEN(regs);
@@ -29,6 +43,10 @@ void isa_reg_display()
   {
     printf("%s\t\t\t %x \n", reg_name(i), gpr(i));
   }
+  for (int i = 0; i < ARRLEN(csrs); i++)
+  {
+    printf("%s\t\t\t %x \n", csrs[i].name, *csrs[i].ptr);
+  }
 }
 
 word_t isa_reg_str2val(const char *s, bool *success)
@@ -48,6 +66,14 @@ word_t isa_reg_str2val(const char *s, bool *success)
       return gpr(i);
     }
   }
+  for (int i = 0; i < ARRLEN(csrs); i++)
+  {
+    if (strcmp(csrs[i].name, s + 1) == 0)
+    {
+      *success = true;
+      return *csrs[i].ptr;
+    }
+  }
   if (strcmp(regs[0], s) == 0)
   {
     {
@@ -14,15 +14,46 @@
 ***************************************************************************************/
 
 #include <isa.h>
+#include "../local-include/reg.h"
 
 word_t isa_raise_intr(word_t NO, vaddr_t epc) {
-  /* TODO: Trigger an interrupt/exception with ``NO''.
+  /* Trigger an interrupt/exception with ``NO''.
    * Then return the address of the interrupt/exception vector.
    */
+  word_t mstatus = cpu.csr.mstatus;
+  // MPIE <- MIE, MIE <- 0, MPP <- M
+  mstatus = (mstatus & ~(MSTATUS_MIE | MSTATUS_MPIE)) | MSTATUS_MPP |
+    ((mstatus & MSTATUS_MIE) ? MSTATUS_MPIE : 0);
+  cpu.csr.mstatus = mstatus;
+  cpu.csr.mepc = epc;
+  cpu.csr.mcause = NO;
+  return cpu.csr.mtvec;
+}
+
+word_t g_mip = 0;
 
-  return 0;
+void isa_set_intr_pin(int no, bool level) {
+  if (level) g_mip |= (word_t)1 << no;
+  else g_mip &= ~((word_t)1 << no);
 }
 
+#define MCAUSE_INTR ((word_t)1 << (sizeof(word_t) * 8 - 1))
+
+// wfi is waiting at cpu.pc, see wfi() in inst.c
+bool wfi_stall = false;
+
+// the pending and enabled interrupt with the highest priority, MEI > MSI > MTI
 word_t isa_query_intr() {
+  static const int prio[] = { INTR_M_EXT, INTR_M_SOFT, INTR_M_TIMER };
+  word_t pending = g_mip & cpu.csr.mie;
+  if (pending == 0 || !(cpu.csr.mstatus & MSTATUS_MIE)) return INTR_EMPTY;
+  if (wfi_stall) {
+    // the interrupt ends wfi, and is taken at the instruction after it
+    wfi_stall = false;
+    cpu.pc += 4;
+  }
+  for (int i = 0; i < ARRLEN(prio); i ++) {
+    if (pending & ((word_t)1 << prio[i])) return MCAUSE_INTR | prio[i];
+  }
   return INTR_EMPTY;
 }
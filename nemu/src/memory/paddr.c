@@ -16,10 +16,16 @@
 #include <memory/host.h>
 #include <memory/paddr.h>
 #include <device/mmio.h>
+#include <cpu/difftest.h>
 #include <isa.h>
+#include <mtrace-def.h>
 
 #if defined(CONFIG_PMEM_MALLOC)
 static uint8_t *pmem = NULL;
+#elif defined(CONFIG_TARGET_SHARE)
+// REF may take the pmem of DUT, see pmem_share()
+static uint8_t pmem_garray[CONFIG_MSIZE] PG_ALIGN = {};
+static uint8_t *pmem = pmem_garray;
 #else // CONFIG_PMEM_GARRAY
 static uint8_t pmem[CONFIG_MSIZE] PG_ALIGN = {};
 #endif
@@ -27,21 +33,40 @@ static uint8_t pmem[CONFIG_MSIZE] PG_ALIGN = {};
 uint8_t *guest_to_host(paddr_t paddr) { return pmem + paddr - CONFIG_MBASE; }
 paddr_t host_to_guest(uint8_t *haddr) { return haddr - pmem + CONFIG_MBASE; }
 
+#ifdef CONFIG_MTRACE
+void mtrace_record(paddr_t addr, int len, word_t data, int type, int region);
+
+static inline void mtrace(paddr_t addr, int len, word_t data, int type, int region)
+{
+  if (type == MEM_TYPE_IFETCH && !ISDEF(CONFIG_MTRACE_IFETCH)) return;
+  if (region == MTRACE_PMEM && !ISDEF(CONFIG_MTRACE_PMEM)) return;
+  if (region == MTRACE_MMIO && !ISDEF(CONFIG_MTRACE_MMIO)) return;
+  if (addr < (paddr_t)CONFIG_MTRACE_ADDR_LO || addr > (paddr_t)CONFIG_MTRACE_ADDR_HI) return;
+  mtrace_record(addr, len, data, type, region);
+}
+#else
+#define mtrace(...)
+#endif
+
+#ifdef CONFIG_TARGET_SHARE
+word_t difftest_ref_mmio_read(paddr_t addr, int len);
+bool difftest_ref_store(paddr_t addr, int len, word_t data);
+
+void pmem_share(uint8_t *host) {
+  IFDEF(CONFIG_PMEM_MALLOC, free(pmem));
+  pmem = host;
+}
+#endif
+
 static word_t pmem_read(paddr_t addr, int len)
 {
   word_t ret = host_read(guest_to_host(addr), len);
-# ifdef CONFIG_MTRACE
-  mlog_write(" PMem_Read : Read  [0x%0x8] from addr <0x%08x> \t by inst@pc<0x%08x>\n", ret, addr, cpu.pc);
-# endif
   return ret;
 }
 
 static void pmem_write(paddr_t addr, int len, word_t data)
 {
   host_write(guest_to_host(addr), len, data);
-# ifdef CONFIG_MTRACE
-  mlog_write("PMem_Write: Write [0x%0x8] to addr   <0x%08x> \t by inst@pc<0x%08x>\n", data, addr, cpu.pc);
-# endif
 }
 
 static void out_of_bound(paddr_t addr)
@@ -60,22 +85,58 @@ void init_mem()
   Log("physical memory area [" FMT_PADDR ", " FMT_PADDR "]", PMEM_LEFT, PMEM_RIGHT);
 }
 
-word_t paddr_read(paddr_t addr, int len)
+static inline word_t paddr_access_read(paddr_t addr, int len, int type)
 {
   if (likely(in_pmem(addr)))
-    return pmem_read(addr, len);
-  IFDEF(CONFIG_DEVICE, return mmio_read(addr, len));
+  {
+    word_t ret = pmem_read(addr, len);
+    mtrace(addr, len, ret, type, MTRACE_PMEM);
+    return ret;
+  }
+#ifdef CONFIG_DEVICE
+  word_t ret = mmio_read(addr, len);
+  mtrace(addr, len, ret, type, MTRACE_MMIO);
+  return ret;
+#endif
+#ifdef CONFIG_TARGET_SHARE
+  // as a difftest REF, take the value DUT has loaded from its device
+  if (type != MEM_TYPE_IFETCH) return difftest_ref_mmio_read(addr, len);
+#endif
   out_of_bound(addr);
   return 0;
 }
 
+word_t paddr_ifetch(paddr_t addr, int len)
+{
+  return paddr_access_read(addr, len, MEM_TYPE_IFETCH);
+}
+
+word_t paddr_read(paddr_t addr, int len)
+{
+  return paddr_access_read(addr, len, MEM_TYPE_READ);
+}
+
 void paddr_write(paddr_t addr, int len, word_t data)
 {
   if (likely(in_pmem(addr)))
   {
+    // batched difftest rolls back the stores when DUT and REF diverge,
+    // pipelined difftest checks them in REF, and REF hashes them (see DIFFTEST_HASH).
+    // With DIFFTEST_SHARE_MEM the store of REF is compared with the one of DUT instead.
+    IFDEF(CONFIG_DIFFTEST, if (CONFIG_DIFFTEST_BATCH > 1 || ISDEF(CONFIG_DIFFTEST_PIPELINE) ||
+          ISDEF(CONFIG_DIFFTEST_SHARE_MEM)) difftest_log_store(addr, len, data));
+    IFDEF(CONFIG_TARGET_SHARE, if (difftest_ref_store(addr, len, data)) return);
     pmem_write(addr, len, data);
+    mtrace(addr, len, data, MEM_TYPE_WRITE, MTRACE_PMEM);
     return;
   }
-  IFDEF(CONFIG_DEVICE, mmio_write(addr, len, data); return);
+#ifdef CONFIG_DEVICE
+  mmio_write(addr, len, data);
+  mtrace(addr, len, data, MEM_TYPE_WRITE, MTRACE_MMIO);
+  return;
+#endif
+#ifdef CONFIG_TARGET_SHARE
+  return; // the store goes to a device of DUT
+#endif
   out_of_bound(addr);
 }
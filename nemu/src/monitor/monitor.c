@@ -15,6 +15,8 @@
 
 #include <isa.h>
 #include <memory/paddr.h>
+#include <trace.h>
+#include <device/replay.h>
 
 void init_rand();
 void init_log(const char *log_file);
@@ -47,6 +49,14 @@ static char *elf_file = NULL;
 static char *diff_so_file = NULL;
 static char *img_file = NULL;
 static int difftest_port = 1234;
+static char *trace_cond_str = NULL;
+static char *record_file = NULL;
+static char *replay_file = NULL;
+static char *frame_dir = NULL;
+static int frame_every = 0;
+static char *wav_file = NULL;
+static char *serial_in = NULL;
+static char *net_spec = NULL;
 
 #ifdef CONFIG_FTRACE
   typedef struct _function_name_address{
@@ -90,17 +100,33 @@ static int parse_args(int argc, char *argv[]) {
     {"diff"     , required_argument, NULL, 'd'},
     {"port"     , required_argument, NULL, 'p'},
     {"elf"      , required_argument, NULL, 'e'},
+    {"trace"    , required_argument, NULL, 't'},
+    {"record"   , required_argument, NULL, 'R'},
+    {"replay"   , required_argument, NULL, 'P'},
+    {"frame-dir", required_argument, NULL, 'F'},
+    {"frame-every", required_argument, NULL, 'N'},
+    {"wav"      , required_argument, NULL, 'W'},
+    {"serial-in", required_argument, NULL, 'S'},
+    {"net"      , required_argument, NULL, 'n'},
     {"help"     , no_argument      , NULL, 'h'},
     {0          , 0                , NULL,  0 },
   };
   int o;
-  while ( (o = getopt_long(argc, argv, "-bhl:d:p:", table, NULL)) != -1) {
+  while ( (o = getopt_long(argc, argv, "-bhl:d:p:t:", table, NULL)) != -1) {
     switch (o) {
       case 'b': sdb_set_batch_mode(); break;
       case 'p': sscanf(optarg, "%d", &difftest_port); break;
       case 'l': log_file = optarg; break;
       case 'd': diff_so_file = optarg; break;
       case 'e': elf_file = optarg; break;
+      case 't': trace_cond_str = optarg; break;
+      case 'R': record_file = optarg; break;
+      case 'P': replay_file = optarg; break;
+      case 'F': frame_dir = optarg; break;
+      case 'N': sscanf(optarg, "%d", &frame_every); break;
+      case 'W': wav_file = optarg; break;
+      case 'S': serial_in = optarg; break;
+      case 'n': net_spec = optarg; break;
       case 1: img_file = optarg; return 0; 
       /*
       If the first character of optstring is '-', then each nonoption argv-element is handled as if it were the argument of an option with character code 1.  
@@ -113,6 +139,14 @@ static int parse_args(int argc, char *argv[]) {
         printf("\t-d,--diff=REF_SO        run DiffTest with reference REF_SO\n");
         printf("\t-p,--port=PORT          run DiffTest with port PORT\n");
         printf("\t-e,--elf=ELF            run ftrace of ELF\n");
+        printf("\t-t,--trace=COND         only trace instructions satisfying COND, see `help trace' in sdb\n");
+        printf("\t--record=FILE           record device input to FILE\n");
+        printf("\t--replay=FILE           replay device input from FILE\n");
+        printf("\t--frame-dir=DIR         write the hashes of the frames to DIR (headless)\n");
+        printf("\t--frame-every=N         also write every N-th frame to DIR as PPM (headless)\n");
+        printf("\t--wav=FILE              write the audio samples to FILE (headless)\n");
+        printf("\t--serial-in=FILE        read the serial input from FILE, or stdin if FILE is -\n");
+        printf("\t--net=SPEC              network backend: loop, pcap:OUT[,IN] or unix:LOCAL,PEER\n");
         printf("\n");
         exit(0);
     }
@@ -139,11 +173,49 @@ void init_monitor(int argc, char *argv[]) {
   put init_elf here is rational.
   */
   init_elf(elf_file);
+#else
+  /* The symbols are also used by the trace condition. */
+  if (elf_file != NULL) init_elf(elf_file);
 #endif
 
   /* Initialize memory. */
   init_mem();
 
+  /* Open the device input log before the devices decide whether to use the host. */
+#ifdef CONFIG_DEVICE_REPLAY
+  init_replay(record_file, replay_file);
+#else
+  Assert(record_file == NULL && replay_file == NULL,
+      "Enable CONFIG_DEVICE_REPLAY to record or replay device input");
+#endif
+
+#if defined(CONFIG_HEADLESS) && defined(CONFIG_HAS_VGA)
+  void init_frame_dump(const char *dir, int every);
+  init_frame_dump(frame_dir, frame_every);
+#else
+  Assert(frame_dir == NULL, "Enable CONFIG_HEADLESS to dump the frames");
+#endif
+#if defined(CONFIG_HEADLESS) && defined(CONFIG_HAS_AUDIO)
+  void init_audio_wav(const char *path);
+  init_audio_wav(wav_file);
+#else
+  Assert(wav_file == NULL, "Enable CONFIG_HEADLESS and CONFIG_HAS_AUDIO to write the audio samples");
+#endif
+
+#ifdef CONFIG_HAS_SERIAL
+  void init_serial_input(const char *path);
+  if (!replay_playing()) init_serial_input(serial_in);
+#else
+  Assert(serial_in == NULL, "Enable CONFIG_HAS_SERIAL to read the serial input");
+#endif
+
+#ifdef CONFIG_HAS_NET
+  void init_net_backend(const char *spec);
+  init_net_backend(net_spec);
+#else
+  Assert(net_spec == NULL, "Enable CONFIG_HAS_NET to choose a network backend");
+#endif
+
   /* Initialize devices. */
   IFDEF(CONFIG_DEVICE, init_device());
 
@@ -159,15 +231,20 @@ void init_monitor(int argc, char *argv[]) {
   /* Initialize the simple debugger. */
   init_sdb();
 
-#ifndef CONFIG_ISA_loongarch32r
-  IFDEF(CONFIG_ITRACE, init_disasm(
+  /* Compile the trace condition given in command line. */
+  if (trace_cond_str != NULL) {
+    Assert(trace_cond_parse(trace_cond_str), "Invalid trace condition '%s'", trace_cond_str);
+  }
+
+#if !defined(CONFIG_ISA_loongarch32r) && (defined(CONFIG_ITRACE) || defined(CONFIG_IQUEUE))
+  init_disasm(
     MUXDEF(CONFIG_ISA_x86,     "i686",
     MUXDEF(CONFIG_ISA_mips32,  "mipsel",
     MUXDEF(CONFIG_ISA_riscv,
     MUXDEF(CONFIG_RV64,        "riscv64",
                                "riscv32"),
                                "bad"))) "-pc-linux-gnu"
-  ));
+  );
 #endif
 
   /* Display welcome message. */
@@ -21,6 +21,7 @@
 #include <sdb/watchpoint.h>
 
 #include <memory/vaddr.h>
+#include <trace.h>
 
 static int is_batch_mode = false;
 
@@ -145,6 +146,18 @@ static int cmd_d(char *args)
   return 0;
 }
 
+// set the condition of itrace
+static int cmd_trace(char *args)
+{
+  IFNDEF(CONFIG_ITRACE, printf("itrace is not enabled, the condition takes no effect\n"));
+  if (args != NULL)
+  {
+    trace_cond_parse(args);
+  }
+  trace_cond_display();
+  return 0;
+}
+
 static struct
 {
   const char *name;
@@ -161,6 +174,7 @@ static struct
     {"px", "Evaluate expression in heximal", cmd_px},
     {"w", "Set wacth point", cmd_w},
     {"d", "Delete break point", cmd_d},
+    {"trace", "Trace only when the condition holds: trace [pc LO HI | func NAME | class CLS... | inst START END | clear][; ...]", cmd_trace},
 };
 
 #define NR_CMD ARRLEN(cmd_table)
@@ -85,6 +85,12 @@ void print_section_headers(Elf32_Ehdr *elf_header, Elf32_Shdr *section_headers,
     }
 }
 
+static int func_info_cmp(const void *a, const void *b)
+{
+    const func_info *x = a, *y = b;
+    return (x->begin_addr > y->begin_addr) - (x->begin_addr < y->begin_addr);
+}
+
 /*
 init_elf is a function introduced to implement ftrace.
 the only purpose of reading elf is just to initialize the func_table.
@@ -159,6 +165,9 @@ void init_elf(const char *elf_fpath)
         free(sym_table);
         free(sym_names);
 
+        // sorted by address, so that ftrace can look up the callee with binary search
+        qsort(func_table, func_table_cnt, sizeof(func_info), func_info_cmp);
+
         // #define FUNCTABLE_DEBUGGING
         #ifdef FUNCTABLE_DEBUGGING
         for (int i = 0; i < func_table_index; i++)
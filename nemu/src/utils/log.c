@@ -29,13 +29,17 @@ FILE *log_fp = NULL;
 FILE *log_ifp = NULL;
 #endif
 #ifdef CONFIG_MTRACE
-FILE *log_mfp = NULL;
+void init_mtrace(const char *log_fpath);
 #endif
 #ifdef CONFIG_FTRACE
 FILE *log_ffp = NULL;
 FILE *elf_fp = NULL;
 #include <elf.h>
 #endif
+#ifdef CONFIG_FTRACE_PROFILE
+FILE *log_fprof_fp = NULL;
+FILE *log_ffold_fp = NULL;
+#endif
 
 void init_log(const char *log_fpath)
 {
@@ -56,13 +60,7 @@ void init_log(const char *log_fpath)
   }
   #endif
 
-  #ifdef CONFIG_MTRACE
-  if (log_fpath != NULL)
-  { 
-    char *mtrace_fname_suffix = "-mtrace";
-    log_mfp = get_log_file(log_fpath,mtrace_fname_suffix);
-  }
-  #endif
+  IFDEF(CONFIG_MTRACE, init_mtrace(log_fpath));
 
   #ifdef CONFIG_FTRACE
   if (log_fpath!=NULL)
@@ -71,10 +69,19 @@ void init_log(const char *log_fpath)
     log_ffp = get_log_file(log_fpath,ftrace_fname_suffix);
   }
   #endif
+
+  #ifdef CONFIG_FTRACE_PROFILE
+  if (log_fpath != NULL)
+  {
+    log_fprof_fp = get_log_file(log_fpath, "-fprofile");
+    log_ffold_fp = get_log_file(log_fpath, "-ffolded"); // collapsed stacks for flamegraph.pl
+  }
+  #endif
 }
 
 bool log_enable()
 {
+  IFDEF(CONFIG_DIFFTEST_REPORT_TRACE, extern bool difftest_trace_window; if (difftest_trace_window) return true);
   return MUXDEF(CONFIG_TRACE, (g_nr_guest_inst >= CONFIG_TRACE_START) && (g_nr_guest_inst <= CONFIG_TRACE_END), false);
 }
 #endif
@@ -88,8 +95,8 @@ FILE * get_log_file(const char* log_fpath, char * fname_suffix){
     insert_pos = insert_pos ? insert_pos : strlen(log_fpath);
     char *trace_fname = insert_string(log_fpath, fname_suffix, insert_pos);
     FILE *fp = fopen(trace_fname, "w");
-    free(trace_fname);
     Assert(fp, "Can not open '%s'", trace_fname);
+    free(trace_fname);
     return fp;
 }
 
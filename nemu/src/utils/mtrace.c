@@ -0,0 +1,64 @@
+#include <isa.h>
+#include <mtrace-def.h>
+
+/*
+Binary memory access tracer.
+Records are collected in a buffer and written with one fwrite() when the buffer is full,
+instead of one fprintf() per access.
+*/
+
+#ifdef CONFIG_MTRACE
+#define MTRACE_BUF_NR 4096
+
+static mtrace_rec mtrace_buf[MTRACE_BUF_NR];
+static int mtrace_nr = 0;
+static FILE *mtrace_fp = NULL;
+
+char *find_last_substr_ptr(const char *str, const char *substr);
+bool log_enable();
+
+void init_mtrace(const char *log_fpath)
+{
+  if (log_fpath == NULL)
+  {
+    Log("mtrace is disabled since no log file is given");
+    return;
+  }
+  // nemu-log.txt -> nemu-log-mtrace.bin
+  const char *ext = find_last_substr_ptr(log_fpath, ".txt");
+  int len = ext ? ext - log_fpath : strlen(log_fpath);
+  char fname[len + 16];
+  snprintf(fname, sizeof(fname), "%.*s-mtrace.bin", len, log_fpath);
+  mtrace_fp = fopen(fname, "wb");
+  Assert(mtrace_fp, "Can not open '%s'", fname);
+
+  mtrace_header h = {.rec_size = sizeof(mtrace_rec), .word_size = sizeof(word_t),
+                     .mbase = CONFIG_MBASE, .msize = CONFIG_MSIZE};
+  memcpy(h.magic, MTRACE_MAGIC, sizeof(h.magic));
+  fwrite(&h, sizeof(h), 1, mtrace_fp);
+  Log("Memory trace is written to %s", fname);
+}
+
+void mtrace_flush()
+{
+  if (mtrace_nr > 0 && mtrace_fp)
+  {
+    size_t ret = fwrite(mtrace_buf, sizeof(mtrace_rec), mtrace_nr, mtrace_fp);
+    Assert(ret == mtrace_nr, "mtrace: write error");
+    fflush(mtrace_fp);
+  }
+  mtrace_nr = 0;
+}
+
+void mtrace_record(paddr_t addr, int len, word_t data, int type, int region)
+{
+  if (mtrace_fp == NULL || !log_enable())
+    return;
+  mtrace_rec *r = &mtrace_buf[mtrace_nr++];
+  *r = (mtrace_rec){.pc = cpu.pc, .addr = addr, .data = data, .len = len, .type = type, .region = region};
+  if (mtrace_nr == MTRACE_BUF_NR)
+    mtrace_flush();
+}
+#else
+void mtrace_flush() {}
+#endif
@@ -3,6 +3,8 @@
 #include <debug.h>
 #include <trace.h>
 
+extern uint64_t g_nr_guest_inst;
+
 // ring buf is an queue.
 #ifdef CONFIG_IRINGBUF_SIZE
 char iringbuf[CONFIG_IRINGBUF_SIZE][128];
@@ -67,50 +69,321 @@ void store_inst2logbuf(Decode *s) // store instruction log information to s->log
 
 extern func_info func_table[10000];
 extern uint32_t func_table_cnt;
+
+/*
+func_table is sorted by begin_addr in init_elf(), so the callee can be found by binary search.
+dnpc2func_idx() is called by every jal/jalr, a linear scan of the whole table is too slow.
+*/
 int dnpc2func_idx(word_t dnpc)
 {
-    for (int i = 0; i < func_table_cnt; i++)
+    int lo = 0, hi = (int)func_table_cnt - 1;
+    while (lo <= hi)
     {
-        if (func_table[i].begin_addr == dnpc)
+        int mid = (lo + hi) / 2;
+        if (func_table[mid].begin_addr == dnpc)
         {
-            return i;
+            return mid;
         }
+        if (func_table[mid].begin_addr < dnpc)
+            lo = mid + 1;
+        else
+            hi = mid - 1;
     }
     return -1;
 }
 
-func_info call_stack[10000];
-uint32_t call_stack_top = 0;
+#ifdef CONFIG_FTRACE
+static bool func_contains(int func_idx, word_t addr)
+{
+    return addr >= func_table[func_idx].begin_addr && addr < func_table[func_idx].end_addr;
+}
+
+#define MAX_CALL_DEPTH 10000
 
-void ftrace_call(word_t pc, word_t dnpc)
+typedef struct
+{
+    int func_idx;    // index of func_table
+    word_t ret_addr; // a `ret` to this address leaves the frame
+    int node;        // node of the calling-context tree
+    uint64_t enter;  // g_nr_guest_inst when the first instruction of the callee is executed
+    uint64_t child_incl;
+} call_frame;
+
+static call_frame call_stack[MAX_CALL_DEPTH];
+static int call_stack_top = 0;
+
+#ifdef CONFIG_FTRACE_PROFILE
+/*
+calling-context tree: one node for every distinct call path, node 0 is the root.
+Children of a node are linked by next_sibling.
+*/
+typedef struct
+{
+    int func_idx;
+    int parent, first_child, next_sibling;
+    uint64_t calls, incl, excl;
+} cct_node;
+
+static cct_node *cct = NULL;
+static int cct_cnt = 0, cct_cap = 0;
+static uint64_t root_child_incl = 0;
+
+static int cct_new(int parent, int func_idx)
+{
+    if (cct_cnt == cct_cap)
+    {
+        cct_cap = cct_cap ? cct_cap * 2 : 1024;
+        cct = realloc(cct, sizeof(cct_node) * cct_cap);
+        Assert(cct, "ftrace: can not allocate calling-context tree");
+    }
+    cct_node *n = &cct[cct_cnt];
+    *n = (cct_node){.func_idx = func_idx, .parent = parent, .first_child = -1, .next_sibling = -1};
+    if (parent >= 0)
+    {
+        n->next_sibling = cct[parent].first_child;
+        cct[parent].first_child = cct_cnt;
+    }
+    return cct_cnt++;
+}
+
+static int cct_child(int parent, int func_idx)
+{
+    if (cct_cnt == 0)
+    {
+        cct_new(-1, -1); // root
+    }
+    for (int c = cct[parent].first_child; c >= 0; c = cct[c].next_sibling)
+    {
+        if (cct[c].func_idx == func_idx)
+        {
+            return c;
+        }
+    }
+    return cct_new(parent, func_idx);
+}
+#endif
+
+static void frame_push(int func_idx, word_t ret_addr)
+{
+    Assert(call_stack_top < MAX_CALL_DEPTH, "ftrace: call stack overflow");
+    call_frame *f = &call_stack[call_stack_top++];
+    f->func_idx = func_idx;
+    f->ret_addr = ret_addr;
+#ifdef CONFIG_FTRACE_PROFILE
+    int parent = call_stack_top > 1 ? call_stack[call_stack_top - 2].node : 0;
+    f->node = cct_child(parent, func_idx);
+    cct[f->node].calls++;
+    f->enter = g_nr_guest_inst + 1; // the jump itself is counted to the caller
+    f->child_incl = 0;
+#endif
+}
+
+// `now` is the value of g_nr_guest_inst after the last instruction of the frame
+static void frame_pop(uint64_t now)
+{
+    call_frame *f = &call_stack[--call_stack_top];
+#ifdef CONFIG_FTRACE_PROFILE
+    uint64_t incl = now - f->enter;
+    cct[f->node].incl += incl;
+    cct[f->node].excl += incl - f->child_incl;
+    if (call_stack_top > 0)
+        call_stack[call_stack_top - 1].child_incl += incl;
+    else
+        root_child_incl += incl;
+#else
+    (void)f;
+    (void)now;
+#endif
+}
+#endif
+
+void ftrace_call(word_t pc, word_t dnpc, int rd)
 {
 #ifdef CONFIG_FTRACE
     int func_idx = dnpc2func_idx(dnpc);
-    if (func_idx >= 0) // this is a call instuction!
+    if (func_idx < 0) // not a call, just a jump inside the function
     {
-        func_info callee = func_table[func_idx];
-        call_stack[call_stack_top++] = callee;
-        flog_write("PC@0x%08x: ", pc);
-        for (int d = 0; d < call_stack_top - 1; d++)
+        return;
+    }
+    word_t ret_addr = pc + 4;
+    bool is_tail = (rd == 0);
+    if (is_tail && call_stack_top > 0)
+    {
+        call_frame *top = &call_stack[call_stack_top - 1];
+        if (top->func_idx == func_idx && func_contains(func_idx, pc)) // a loop back to the entry
         {
-            flog_write("\t");
+            return;
         }
-        flog_write("call [%s@0x%08x]\n", callee.name, callee.begin_addr);
+        // the callee replaces the current frame and returns to its caller directly
+        ret_addr = top->ret_addr;
+        frame_pop(g_nr_guest_inst + 1);
+    }
+    frame_push(func_idx, ret_addr);
+
+#ifdef CONFIG_FTRACE_LOG
+    func_info *callee = &func_table[func_idx];
+    flog_write("PC@0x%08x: ", pc);
+    for (int d = 0; d < call_stack_top - 1; d++)
+    {
+        flog_write("\t");
     }
+    flog_write("%s [%s@0x%08x]\n", is_tail ? "tail" : "call", callee->name, callee->begin_addr);
+#endif
 #endif
 }
 
 void ftrace_ret(word_t pc, word_t dnpc)
 {
 #ifdef CONFIG_FTRACE
-    Assert(call_stack_top > 0, "Wrong: RET before CALL");
-    func_info env = call_stack[--call_stack_top];
+    if (call_stack_top == 0) // RET before CALL, e.g. returning from the entry of the program
+    {
+        return;
+    }
+    // the frame which expects this return address, frames above it were left by tail calls or longjmp
+    int i = call_stack_top - 1;
+    while (i >= 0 && call_stack[i].ret_addr != dnpc)
+    {
+        i--;
+    }
+    if (i < 0)
+    {
+        // longjmp-style unwind: keep the innermost frame whose function contains the target
+        int j = call_stack_top - 2;
+        while (j >= 0 && !func_contains(call_stack[j].func_idx, dnpc))
+        {
+            j--;
+        }
+        i = (j >= 0) ? j + 1 : call_stack_top - 1;
+    }
+    int func_idx = call_stack[i].func_idx;
+    while (call_stack_top > i)
+    {
+        frame_pop(g_nr_guest_inst + 1); // the ret is counted to the callee
+    }
 
+#ifdef CONFIG_FTRACE_LOG
     flog_write("PC@0x%08x: ", pc);
     for (int d = 0; d < call_stack_top; d++)
     {
         flog_write("\t");
     }
-    flog_write("ret [%s]\n", env.name);
+    flog_write("ret [%s]\n", func_table[func_idx].name);
+#else
+    (void)func_idx;
+#endif
 #endif
 }
+
+#ifdef CONFIG_FTRACE_PROFILE
+static const char *cct_name(int node)
+{
+    return node == 0 ? "(root)" : func_table[cct[node].func_idx].name;
+}
+
+// collapsed stack of a node: "main;foo;bar"
+static void cct_print_path(FILE *fp, int node)
+{
+    if (cct[node].parent > 0)
+    {
+        cct_print_path(fp, cct[node].parent);
+        fputc(';', fp);
+    }
+    fputs(cct_name(node), fp);
+}
+
+// a recursive call is already included in the inclusive cost of its outer instance
+static bool cct_is_recursive(int node)
+{
+    for (int p = cct[node].parent; p > 0; p = cct[p].parent)
+    {
+        if (cct[p].func_idx == cct[node].func_idx)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+typedef struct
+{
+    int func_idx;
+    uint64_t calls, incl, excl;
+} func_cost;
+
+static int func_cost_cmp(const void *a, const void *b)
+{
+    const func_cost *x = a, *y = b;
+    if (x->excl != y->excl)
+        return x->excl < y->excl ? 1 : -1;
+    return x->incl < y->incl ? 1 : (x->incl > y->incl ? -1 : 0);
+}
+
+void ftrace_profile_dump()
+{
+    extern FILE *log_fprof_fp;
+    extern FILE *log_ffold_fp;
+
+    uint64_t now = g_nr_guest_inst;
+    while (call_stack_top > 0) // frames which are still open when the program ends
+    {
+        frame_pop(now);
+    }
+    if (cct_cnt == 0)
+    {
+        cct_new(-1, -1);
+    }
+    cct[0].calls = 1;
+    cct[0].incl = now;
+    cct[0].excl = now - root_child_incl;
+
+    // flat profile
+    func_cost *cost = calloc(func_table_cnt, sizeof(func_cost));
+    Assert(cost, "ftrace: can not allocate profile");
+    for (int i = 0; i < func_table_cnt; i++)
+    {
+        cost[i].func_idx = i;
+    }
+    for (int n = 1; n < cct_cnt; n++)
+    {
+        func_cost *c = &cost[cct[n].func_idx];
+        c->calls += cct[n].calls;
+        c->excl += cct[n].excl;
+        if (!cct_is_recursive(n))
+        {
+            c->incl += cct[n].incl;
+        }
+    }
+    qsort(cost, func_table_cnt, sizeof(func_cost), func_cost_cmp);
+
+    FILE *fp = log_fprof_fp ? log_fprof_fp : stdout;
+    double total = now ? (double)now : 1;
+    fprintf(fp, "total guest instructions = %" PRIu64 ", root exclusive = %" PRIu64 "\n", now, cct[0].excl);
+    fprintf(fp, "%12s %16s %7s %16s %7s  %s\n", "calls", "exclusive", "excl%", "inclusive", "incl%", "function");
+    for (int i = 0; i < func_table_cnt && cost[i].calls > 0; i++)
+    {
+        func_cost *c = &cost[i];
+        fprintf(fp, "%12" PRIu64 " %16" PRIu64 " %6.2f%% %16" PRIu64 " %6.2f%%  %s\n",
+                c->calls, c->excl, c->excl * 100 / total, c->incl, c->incl * 100 / total,
+                func_table[c->func_idx].name);
+    }
+    fflush(fp);
+    free(cost);
+
+    // collapsed stacks, one line per calling context, e.g. for flamegraph.pl
+    if (log_ffold_fp)
+    {
+        for (int n = 0; n < cct_cnt; n++)
+        {
+            if (cct[n].excl == 0)
+                continue;
+            cct_print_path(log_ffold_fp, n);
+            fprintf(log_ffold_fp, " %" PRIu64 "\n", cct[n].excl);
+        }
+        fflush(log_ffold_fp);
+    }
+    Log("ftrace profile: %d calling contexts, report is written to %s", cct_cnt,
+        log_fprof_fp ? "the -fprofile log file" : "stdout");
+}
+#else
+void ftrace_profile_dump() {}
+#endif
@@ -0,0 +1,235 @@
+#include <cpu/decode.h>
+#include <trace.h>
+
+/*
+Trace condition: only trace the instructions we are interested in.
+A condition is a list of clauses separated by ';', e.g.
+  func foo; class load store; inst 1000 2000
+  pc LO HI      trace instructions with LO <= pc < HI
+  func NAME     trace instructions inside function NAME (needs the ELF file)
+  class CLS...  trace instructions of the given classes: load store branch jump alu system
+  inst S E      trace the S-th to the (E-1)-th instruction
+  clear         remove all conditions
+pc and func clauses are ORed, different kinds of clauses are ANDed.
+The clauses are compiled into trace_cond, so that the per-instruction check is O(1).
+*/
+
+trace_cond_t trace_cond = {.enable = false, .inst_start = 0, .inst_end = UINT64_MAX};
+
+#define MAX_PC_RANGE 64
+
+typedef struct
+{
+    char name[100];
+    vaddr_t lo, hi;
+} pc_range;
+
+static pc_range pc_ranges[MAX_PC_RANGE];
+static int nr_pc_range = 0;
+static uint32_t class_mask = 0;
+
+enum
+{
+    IC_LOAD,
+    IC_STORE,
+    IC_BRANCH,
+    IC_JUMP,
+    IC_ALU,
+    IC_SYSTEM,
+    NR_IC
+};
+static const char *class_name[NR_IC] = {"load", "store", "branch", "jump", "alu", "system"};
+
+#ifdef CONFIG_ISA_riscv
+// major opcode (inst[6:0]) -> instruction class
+static int opcode2class(int opcode)
+{
+    switch (opcode)
+    {
+    case 0x03: return IC_LOAD;
+    case 0x23: return IC_STORE;
+    case 0x63: return IC_BRANCH;
+    case 0x6f: case 0x67: return IC_JUMP;
+    case 0x13: case 0x33: case 0x37: case 0x17: return IC_ALU;
+    case 0x73: return IC_SYSTEM;
+    default: return -1;
+    }
+}
+#endif
+
+static void compile()
+{
+    if (nr_pc_range > 0)
+    {
+        size_t size = ((CONFIG_MSIZE >> TCOND_PC_SHIFT) + 7) / 8;
+        if (trace_cond.pc_bitmap == NULL)
+        {
+            trace_cond.pc_bitmap = malloc(size);
+            Assert(trace_cond.pc_bitmap, "trace condition: can not allocate pc bitmap");
+        }
+        memset(trace_cond.pc_bitmap, 0, size);
+        for (int i = 0; i < nr_pc_range; i++)
+        {
+            // only the part of the range inside pmem has slots
+            uint64_t lo = pc_ranges[i].lo, hi = pc_ranges[i].hi;
+            if (lo < CONFIG_MBASE)
+                lo = CONFIG_MBASE;
+            if (hi > (uint64_t)CONFIG_MBASE + CONFIG_MSIZE)
+                hi = (uint64_t)CONFIG_MBASE + CONFIG_MSIZE;
+            if (lo >= hi)
+                continue;
+            uint64_t first = (lo - CONFIG_MBASE) >> TCOND_PC_SHIFT;
+            uint64_t last = (hi - 1 - CONFIG_MBASE) >> TCOND_PC_SHIFT;
+            for (uint64_t slot = first; slot <= last; slot++)
+            {
+                if ((slot & 7) == 0 && slot + 7 <= last)
+                {
+                    // a whole byte of the bitmap
+                    trace_cond.pc_bitmap[slot >> 3] = 0xff;
+                    slot += 7;
+                    continue;
+                }
+                trace_cond.pc_bitmap[slot >> 3] |= 1 << (slot & 7);
+            }
+        }
+    }
+    else
+    {
+        free(trace_cond.pc_bitmap);
+        trace_cond.pc_bitmap = NULL;
+    }
+
+    trace_cond.has_class = (class_mask != 0);
+#ifdef CONFIG_ISA_riscv
+    for (int op = 0; op < ARRLEN(trace_cond.class_ok); op++)
+    {
+        int c = opcode2class(op);
+        trace_cond.class_ok[op] = (c >= 0) && (class_mask & (1u << c));
+    }
+#endif
+
+    trace_cond.enable = nr_pc_range > 0 || trace_cond.has_class ||
+                        trace_cond.inst_start != 0 || trace_cond.inst_end != UINT64_MAX;
+}
+
+static bool add_pc_range(const char *name, vaddr_t lo, vaddr_t hi)
+{
+    if (nr_pc_range == MAX_PC_RANGE)
+    {
+        printf("trace: too many pc ranges (max %d)\n", MAX_PC_RANGE);
+        return false;
+    }
+    pc_range *r = &pc_ranges[nr_pc_range++];
+    snprintf(r->name, sizeof(r->name), "%s", name);
+    r->lo = lo;
+    r->hi = hi;
+    return true;
+}
+
+static bool add_func(const char *name)
+{
+    extern func_info func_table[10000];
+    extern uint32_t func_table_cnt;
+    bool found = false;
+    for (int i = 0; i < func_table_cnt; i++)
+    {
+        if (strcmp(func_table[i].name, name) == 0)
+        {
+            found = add_pc_range(name, func_table[i].begin_addr, func_table[i].end_addr);
+            break;
+        }
+    }
+    if (!found)
+        printf("trace: function '%s' is not found, is the ELF file given with --elf?\n", name);
+    return found;
+}
+
+static bool parse_clause(char *clause)
+{
+    char *save = NULL;
+    char *kind = strtok_r(clause, " \t", &save);
+    if (kind == NULL)
+        return true;
+    char *a1 = strtok_r(NULL, " \t", &save);
+    if (strcmp(kind, "clear") == 0)
+    {
+        nr_pc_range = 0;
+        class_mask = 0;
+        trace_cond.inst_start = 0;
+        trace_cond.inst_end = UINT64_MAX;
+        return true;
+    }
+    if (strcmp(kind, "func") == 0 && a1)
+        return add_func(a1);
+    char *a2 = strtok_r(NULL, " \t", &save);
+    if (strcmp(kind, "pc") == 0 && a1 && a2)
+    {
+        vaddr_t lo = strtoull(a1, NULL, 0), hi = strtoull(a2, NULL, 0);
+        char name[100];
+        snprintf(name, sizeof(name), "pc [" FMT_WORD ", " FMT_WORD ")", lo, hi);
+        return add_pc_range(name, lo, hi);
+    }
+    if (strcmp(kind, "inst") == 0 && a1 && a2)
+    {
+        trace_cond.inst_start = strtoull(a1, NULL, 0);
+        trace_cond.inst_end = strtoull(a2, NULL, 0);
+        return true;
+    }
+    if (strcmp(kind, "class") == 0 && a1)
+    {
+        if (!ISDEF(CONFIG_ISA_riscv))
+        {
+            printf("trace: class is only supported on riscv\n");
+            return false;
+        }
+        for (char *c = a1; c; c = a2, a2 = strtok_r(NULL, " \t", &save))
+        {
+            int i;
+            for (i = 0; i < NR_IC && strcmp(c, class_name[i]) != 0; i++)
+                ;
+            if (i == NR_IC)
+            {
+                printf("trace: unknown instruction class '%s'\n", c);
+                return false;
+            }
+            class_mask |= 1u << i;
+        }
+        return true;
+    }
+    printf("trace: invalid clause '%s'\n", kind);
+    return false;
+}
+
+bool trace_cond_parse(char *spec)
+{
+    bool ok = true;
+    char *save = NULL;
+    for (char *clause = strtok_r(spec, ";", &save); clause; clause = strtok_r(NULL, ";", &save))
+    {
+        ok &= parse_clause(clause);
+    }
+    compile();
+    return ok;
+}
+
+void trace_cond_display()
+{
+    if (!trace_cond.enable)
+    {
+        printf("trace: every instruction is traced\n");
+        return;
+    }
+    for (int i = 0; i < nr_pc_range; i++)
+    {
+        printf("%-24s [" FMT_WORD ", " FMT_WORD ")\n", pc_ranges[i].name, pc_ranges[i].lo, pc_ranges[i].hi);
+    }
+    if (class_mask)
+    {
+        printf("class:");
+        for (int i = 0; i < NR_IC; i++)
+            if (class_mask & (1u << i))
+                printf(" %s", class_name[i]);
+        printf("\n");
+    }
+    printf("inst: [%" PRIu64 ", %" PRIu64 ")\n", trace_cond.inst_start, trace_cond.inst_end);
+}
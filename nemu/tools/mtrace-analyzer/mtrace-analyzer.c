@@ -0,0 +1,345 @@
+/*
+Offline analyzer for the binary memory trace written by NEMU (CONFIG_MTRACE).
+
+  mtrace-analyzer [options] nemu-log-mtrace.bin
+
+  -d         dump records as text (default when no analysis is selected)
+  -p         per-page access heatmap
+  -r         reuse-distance histogram at cache-line granularity
+  -s SHIFT   page size is 2^SHIFT bytes for -p (default 12)
+  -n N       show the N hottest pages for -p (default 32)
+  -l SIZE    cache line size in bytes for -r (default 64)
+  -m N       only analyze the first N records
+  -t TYPES   only keep the given access types, any of "irw" (default "rw")
+  -g REGIONS only keep the given regions, any of "pm" (pmem, mmio, default "pm")
+  -a LO:HI   only keep accesses with LO <= addr <= HI
+*/
+
+#include <assert.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mtrace-def.h>
+
+#define CHUNK_NR 4096
+
+static bool opt_dump = false, opt_page = false, opt_reuse = false;
+static int page_shift = 12;
+static int top_n = 32;
+static uint64_t line_size = 64;
+static uint64_t max_rec = UINT64_MAX;
+static bool keep_type[3] = { false, true, true };
+static bool keep_region[2] = { true, true };
+static uint64_t addr_lo = 0, addr_hi = UINT64_MAX;
+
+static FILE *fp = NULL;
+static mtrace_header hdr;
+static uint64_t nr_rec = 0;
+
+static void usage(const char *prog) {
+  fprintf(stderr, "Usage: %s [-d] [-p] [-r] [-s SHIFT] [-n N] [-l SIZE] [-m N] "
+      "[-t irw] [-g pm] [-a LO:HI] FILE\n", prog);
+  exit(1);
+}
+
+static void parse_args(int argc, char *argv[]) {
+  int o;
+  while ((o = getopt(argc, argv, "dprs:n:l:m:t:g:a:")) != -1) {
+    switch (o) {
+      case 'd': opt_dump = true; break;
+      case 'p': opt_page = true; break;
+      case 'r': opt_reuse = true; break;
+      case 's': page_shift = atoi(optarg); break;
+      case 'n': top_n = atoi(optarg); break;
+      case 'l': line_size = strtoull(optarg, NULL, 0); break;
+      case 'm': max_rec = strtoull(optarg, NULL, 0); break;
+      case 't':
+        memset(keep_type, 0, sizeof(keep_type));
+        for (char *p = optarg; *p; p ++) {
+          switch (*p) {
+            case 'i': keep_type[MTRACE_IFETCH] = true; break;
+            case 'r': keep_type[MTRACE_READ] = true; break;
+            case 'w': keep_type[MTRACE_WRITE] = true; break;
+            default: usage(argv[0]);
+          }
+        }
+        break;
+      case 'g':
+        memset(keep_region, 0, sizeof(keep_region));
+        for (char *p = optarg; *p; p ++) {
+          switch (*p) {
+            case 'p': keep_region[MTRACE_PMEM] = true; break;
+            case 'm': keep_region[MTRACE_MMIO] = true; break;
+            default: usage(argv[0]);
+          }
+        }
+        break;
+      case 'a': {
+        char *sep = strchr(optarg, ':');
+        if (sep == NULL) usage(argv[0]);
+        addr_lo = strtoull(optarg, NULL, 0);
+        addr_hi = strtoull(sep + 1, NULL, 0);
+        break;
+      }
+      default: usage(argv[0]);
+    }
+  }
+  if (optind != argc - 1) usage(argv[0]);
+  if (!opt_page && !opt_reuse) opt_dump = true;
+  if (line_size == 0 || (line_size & (line_size - 1)) != 0) {
+    fprintf(stderr, "line size must be a power of 2\n");
+    exit(1);
+  }
+  if (page_shift < 0 || page_shift > 40) usage(argv[0]);
+}
+
+static void open_trace(const char *fname) {
+  fp = fopen(fname, "rb");
+  if (fp == NULL) { perror(fname); exit(1); }
+  if (fread(&hdr, sizeof(hdr), 1, fp) != 1 || memcmp(hdr.magic, MTRACE_MAGIC, sizeof(hdr.magic)) != 0) {
+    fprintf(stderr, "%s: not a NEMU memory trace\n", fname);
+    exit(1);
+  }
+  if (hdr.rec_size != sizeof(mtrace_rec)) {
+    fprintf(stderr, "%s: record size %u does not match %zu\n", fname, hdr.rec_size, sizeof(mtrace_rec));
+    exit(1);
+  }
+  fseek(fp, 0, SEEK_END);
+  nr_rec = (ftell(fp) - sizeof(hdr)) / sizeof(mtrace_rec);
+  if (nr_rec > max_rec) nr_rec = max_rec;
+  fseek(fp, sizeof(hdr), SEEK_SET);
+}
+
+static bool keep(const mtrace_rec *r) {
+  return r->type < 3 && keep_type[r->type] && r->region < 2 && keep_region[r->region] &&
+    r->addr >= addr_lo && r->addr <= addr_hi;
+}
+
+// call `f` for each kept record, return the number of them
+static uint64_t for_each_rec(void (*f)(const mtrace_rec *)) {
+  static mtrace_rec buf[CHUNK_NR];
+  uint64_t left = nr_rec, kept = 0;
+  fseek(fp, sizeof(hdr), SEEK_SET);
+  while (left > 0) {
+    size_t n = fread(buf, sizeof(mtrace_rec), left < CHUNK_NR ? left : CHUNK_NR, fp);
+    if (n == 0) break;
+    left -= n;
+    for (size_t i = 0; i < n; i ++) {
+      if (keep(&buf[i])) { f(&buf[i]); kept ++; }
+    }
+  }
+  return kept;
+}
+
+/* ------------------------------- dump ------------------------------- */
+
+static void dump_one(const mtrace_rec *r) {
+  static const char *type_str[] = { "I", "R", "W" };
+  int w = hdr.word_size * 2;
+  printf("pc=0x%0*" PRIx64 " %s %s addr=0x%0*" PRIx64 " len=%u data=0x%0*" PRIx64 "\n",
+      w, r->pc, type_str[r->type], r->region == MTRACE_MMIO ? "mmio" : "pmem",
+      w, r->addr, r->len, r->len * 2, r->data);
+}
+
+/* ------------------------------ heatmap ----------------------------- */
+
+typedef struct {
+  uint64_t page;
+  uint64_t cnt[3];
+  bool used;
+} page_stat;
+
+static page_stat *ptab = NULL;
+static uint64_t ptab_size = 0, ptab_used = 0;
+
+static inline uint64_t hash64(uint64_t x) {
+  x ^= x >> 33; x *= 0xff51afd7ed558ccdULL;
+  x ^= x >> 33; x *= 0xc4ceb9fe1a85ec53ULL;
+  x ^= x >> 33;
+  return x;
+}
+
+static page_stat *page_lookup(uint64_t page) {
+  if (ptab_used * 2 >= ptab_size) {
+    page_stat *old = ptab;
+    uint64_t old_size = ptab_size;
+    ptab_size = old_size ? old_size * 2 : 1024;
+    ptab = calloc(ptab_size, sizeof(page_stat));
+    assert(ptab);
+    ptab_used = 0;
+    for (uint64_t i = 0; i < old_size; i ++) {
+      if (old[i].used) { *page_lookup(old[i].page) = old[i]; }
+    }
+    free(old);
+  }
+  uint64_t i = hash64(page) & (ptab_size - 1);
+  while (ptab[i].used && ptab[i].page != page) i = (i + 1) & (ptab_size - 1);
+  if (!ptab[i].used) {
+    ptab[i].used = true;
+    ptab[i].page = page;
+    ptab_used ++;
+  }
+  return &ptab[i];
+}
+
+static void page_one(const mtrace_rec *r) {
+  page_lookup(r->addr >> page_shift)->cnt[r->type] ++;
+}
+
+static uint64_t page_total(const page_stat *p) { return p->cnt[0] + p->cnt[1] + p->cnt[2]; }
+
+static int page_cmp(const void *a, const void *b) {
+  uint64_t x = page_total(a), y = page_total(b);
+  return x < y ? 1 : (x > y ? -1 : 0);
+}
+
+static void report_page(uint64_t kept) {
+  page_stat *arr = malloc((ptab_used + 1) * sizeof(page_stat));
+  assert(arr);
+  uint64_t n = 0;
+  for (uint64_t i = 0; i < ptab_size; i ++) if (ptab[i].used) arr[n ++] = ptab[i];
+  qsort(arr, n, sizeof(page_stat), page_cmp);
+
+  printf("==== page heatmap: %" PRIu64 " accesses, %" PRIu64 " pages of %llu bytes ====\n",
+      kept, n, 1ull << page_shift);
+  printf("%-18s %12s %12s %12s %7s  %s\n", "page", "ifetch", "read", "write", "%", "");
+  uint64_t max = n > 0 ? page_total(&arr[0]) : 1;
+  for (uint64_t i = 0; i < n && i < (uint64_t)top_n; i ++) {
+    uint64_t t = page_total(&arr[i]);
+    char bar[41];
+    int len = (int)(t * 40 / max);
+    memset(bar, '#', len);
+    bar[len] = '\0';
+    printf("0x%016" PRIx64 " %12" PRIu64 " %12" PRIu64 " %12" PRIu64 " %6.2f%%  %s\n",
+        arr[i].page << page_shift, arr[i].cnt[0], arr[i].cnt[1], arr[i].cnt[2],
+        kept ? t * 100.0 / kept : 0.0, bar);
+  }
+  if (n > (uint64_t)top_n) printf("... %" PRIu64 " more pages\n", n - top_n);
+  free(arr);
+}
+
+/* --------------------------- reuse distance -------------------------- */
+
+/*
+The reuse distance of an access is the number of distinct lines touched since the
+previous access to the same line. Only the latest access of each line is marked in a
+Fenwick tree indexed by time, so the distance is the number of marks after that time.
+An access with reuse distance d hits in a fully-associative LRU cache of more than d lines.
+*/
+
+#define NR_BUCKET 48
+
+typedef struct {
+  uint64_t line;
+  uint64_t last; // time of the last access + 1, 0 means empty
+} line_stat;
+
+static uint32_t *fenwick = NULL;
+static uint64_t fenwick_size = 0;
+static uint64_t now = 0;
+static line_stat *ltab = NULL;
+static uint64_t ltab_size = 0, ltab_used = 0;
+static uint64_t hist[NR_BUCKET];
+static uint64_t cold = 0;
+static int line_shift = 0;
+
+static void fenwick_add(uint64_t i, int v) {
+  for (i ++; i <= fenwick_size; i += i & -i) fenwick[i] += v;
+}
+
+static uint64_t fenwick_sum(uint64_t i) { // sum of [0, i)
+  uint64_t s = 0;
+  for (; i > 0; i -= i & -i) s += fenwick[i];
+  return s;
+}
+
+static line_stat *line_lookup(uint64_t line) {
+  if (ltab_used * 2 >= ltab_size) {
+    line_stat *old = ltab;
+    uint64_t old_size = ltab_size;
+    ltab_size = old_size ? old_size * 2 : 4096;
+    ltab = calloc(ltab_size, sizeof(line_stat));
+    assert(ltab);
+    ltab_used = 0;
+    for (uint64_t i = 0; i < old_size; i ++) {
+      if (old[i].last) { *line_lookup(old[i].line) = old[i]; }
+    }
+    free(old);
+  }
+  uint64_t i = hash64(line) & (ltab_size - 1);
+  while (ltab[i].last && ltab[i].line != line) i = (i + 1) & (ltab_size - 1);
+  if (!ltab[i].last) {
+    ltab[i].line = line;
+    ltab_used ++;
+  }
+  return &ltab[i];
+}
+
+static int bucket_of(uint64_t d) { // 0 -> 0, 1 -> 1, [2, 4) -> 2, [4, 8) -> 3, ...
+  int b = 0;
+  while (d) { b ++; d >>= 1; }
+  return b < NR_BUCKET ? b : NR_BUCKET - 1;
+}
+
+static void reuse_one(const mtrace_rec *r) {
+  uint64_t first = r->addr >> line_shift;
+  uint64_t last = (r->addr + (r->len ? r->len : 1) - 1) >> line_shift;
+  for (uint64_t line = first; line <= last; line ++) {
+    line_stat *l = line_lookup(line);
+    if (l->last) {
+      uint64_t prev = l->last - 1;
+      hist[bucket_of(fenwick_sum(now) - fenwick_sum(prev + 1))] ++;
+      fenwick_add(prev, -1);
+    } else {
+      cold ++;
+    }
+    fenwick_add(now, 1);
+    l->last = now + 1;
+    now ++;
+  }
+}
+
+static void report_reuse(uint64_t kept) {
+  uint64_t total = cold;
+  for (int i = 0; i < NR_BUCKET; i ++) total += hist[i];
+  printf("==== reuse distance: %" PRIu64 " accesses, %" PRIu64 " distinct lines of %" PRIu64 " bytes ====\n",
+      kept, ltab_used, line_size);
+  printf("%-24s %14s %8s %22s\n", "distance (lines)", "count", "%", "LRU hit rate (size)");
+  uint64_t cum = 0;
+  for (int i = 0; i < NR_BUCKET; i ++) {
+    if (hist[i] == 0) continue;
+    uint64_t lo = i == 0 ? 0 : 1ull << (i - 1);
+    uint64_t hi = i == 0 ? 0 : (1ull << i) - 1;
+    cum += hist[i];
+    char range[48], size[32];
+    snprintf(range, sizeof(range), "[%" PRIu64 ", %" PRIu64 "]", lo, hi);
+    snprintf(size, sizeof(size), "%" PRIu64 "B", (hi + 1) * line_size);
+    // all accesses with distance <= hi hit in a cache of hi + 1 lines
+    printf("%-24s %14" PRIu64 " %7.2f%% %12.2f%% (%s)\n", range, hist[i],
+        hist[i] * 100.0 / total, cum * 100.0 / total, size);
+  }
+  printf("%-24s %14" PRIu64 " %7.2f%%\n", "cold", cold, total ? cold * 100.0 / total : 0.0);
+}
+
+int main(int argc, char *argv[]) {
+  parse_args(argc, argv);
+  open_trace(argv[optind]);
+  fprintf(stderr, "%" PRIu64 " records, guest word size = %u, pmem = [0x%" PRIx64 ", 0x%" PRIx64 ")\n",
+      nr_rec, hdr.word_size, hdr.mbase, hdr.mbase + hdr.msize);
+
+  if (opt_dump) for_each_rec(dump_one);
+  if (opt_page) report_page(for_each_rec(page_one));
+  if (opt_reuse) {
+    while ((1ull << line_shift) < line_size) line_shift ++;
+    // an access of at most 8 bytes takes one time slot per line it covers
+    fenwick_size = nr_rec * ((8 + line_size - 1) / line_size + 1);
+    fenwick = calloc(fenwick_size + 1, sizeof(uint32_t));
+    assert(fenwick);
+    report_reuse(for_each_rec(reuse_one));
+  }
+  fclose(fp);
+  return 0;
+}
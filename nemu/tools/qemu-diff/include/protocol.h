@@ -35,3 +35,10 @@ void gdb_send(struct gdb_conn *conn, const uint8_t *command, size_t size);
 uint8_t *gdb_recv(struct gdb_conn *conn, size_t *size);
 
 const char * gdb_start_noack(struct gdb_conn *conn);
+
+// Wait until a reply is ready to be received, or `timeout_ms' elapses.
+// Only valid in no-ack mode.
+bool gdb_poll(struct gdb_conn *conn, int timeout_ms);
+
+// Send the interrupt character to stop the running target.
+void gdb_interrupt(struct gdb_conn *conn);
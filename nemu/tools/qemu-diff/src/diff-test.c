@@ -20,19 +20,21 @@
 
 bool gdb_connect_qemu(int);
 bool gdb_memcpy_to_qemu(uint32_t, void *, int);
+bool gdb_memcpy_from_qemu(uint32_t, void *, int);
 bool gdb_getregs(union isa_gdb_regs *);
 bool gdb_setregs(union isa_gdb_regs *);
 bool gdb_si();
+bool gdb_has_noack();
+bool gdb_set_breakpoint(uint32_t, bool);
+bool gdb_continue(int);
 void gdb_exit();
 
 void init_isa();
 
 __EXPORT void difftest_memcpy(paddr_t addr, void *buf, size_t n, bool direction) {
-  assert(direction == DIFFTEST_TO_REF);
-  if (direction == DIFFTEST_TO_REF) {
-    bool ok = gdb_memcpy_to_qemu(addr, buf, n);
-    assert(ok == 1);
-  }
+  bool ok = (direction == DIFFTEST_TO_REF) ?
+    gdb_memcpy_to_qemu(addr, buf, n) : gdb_memcpy_from_qemu(addr, buf, n);
+  assert(ok == 1);
 }
 
 __EXPORT void difftest_regcpy(void *dut, bool direction) {
@@ -50,6 +52,76 @@ __EXPORT void difftest_exec(uint64_t n) {
   while (n --) gdb_si();
 }
 
+/*
+Stepping costs a round trip per instruction, while running to a breakpoint costs
+one round trip however many instructions are executed. DUT passes the pcs of the
+instructions it has executed, pc[0] .. pc[n - 1], and pc[n] where it stops, so REF
+can reach pc[k] with a breakpoint and step the rest. The k with the fewest round
+trips is chosen: the breakpoint at pc[k] is hit once for every earlier occurrence
+of pc[k], and each of them needs another step to move away from it.
+*/
+#define CONT_TIMEOUT_MS 1000
+
+static struct { uint64_t pc, cnt; } *pc_cnt = NULL;
+static uint64_t pc_cnt_size = 0;
+
+static uint64_t *count_pc(uint64_t pc) {
+  uint64_t i = (pc * 0x9e3779b97f4a7c15ull) & (pc_cnt_size - 1);
+  while (pc_cnt[i].cnt != 0 && pc_cnt[i].pc != pc) i = (i + 1) & (pc_cnt_size - 1);
+  pc_cnt[i].pc = pc;
+  return &pc_cnt[i].cnt;
+}
+
+static uint64_t choose_target(const uint64_t *pc, uint64_t n, uint64_t *best_cost) {
+  if (pc_cnt_size < 2 * (n + 1)) {
+    while (pc_cnt_size < 2 * (n + 1)) pc_cnt_size = pc_cnt_size ? pc_cnt_size * 2 : 1024;
+    pc_cnt = realloc(pc_cnt, sizeof(*pc_cnt) * pc_cnt_size);
+    assert(pc_cnt != NULL);
+  }
+  memset(pc_cnt, 0, sizeof(*pc_cnt) * pc_cnt_size);
+
+  uint64_t best = 0;
+  *best_cost = n; // step all of them
+  for (uint64_t k = 1; k <= n; k ++) {
+    uint64_t hits = ++ *count_pc(pc[k]);
+    // set and clear the breakpoint, continue for each hit, step away from
+    // all but the last one and from the start, then step the rest
+    uint64_t cost = 2 + hits + (hits - 1) + (pc[0] == pc[k]) + (n - k);
+    if (cost < *best_cost) {
+      *best_cost = cost;
+      best = k;
+    }
+  }
+  return best;
+}
+
+__EXPORT void difftest_exec_trace(const uint64_t *pc, uint64_t n) {
+  uint64_t cost;
+  uint64_t k = gdb_has_noack() ? choose_target(pc, n, &cost) : 0;
+  if (k == 0 || !gdb_set_breakpoint(pc[k], true)) {
+    difftest_exec(n);
+    return;
+  }
+
+  uint64_t cur = 0;
+  bool ok = true;
+  while (cur < k) {
+    if (pc[cur] == pc[k]) {
+      gdb_si();
+      cur ++;
+      continue;
+    }
+    if (!gdb_continue(CONT_TIMEOUT_MS)) {
+      // REF has gone another way than DUT, and the registers will not agree
+      ok = false;
+      break;
+    }
+    for (cur ++; pc[cur] != pc[k]; cur ++);
+  }
+  gdb_set_breakpoint(pc[k], false);
+  if (ok) difftest_exec(n - k);
+}
+
 __EXPORT void difftest_init(int port) {
   char buf[32];
   sprintf(buf, "tcp::%d", port);
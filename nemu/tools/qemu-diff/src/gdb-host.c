@@ -17,48 +17,149 @@
 
 static struct gdb_conn *conn;
 
+// the largest packet accepted by the stub, reported in qSupported
+static int packet_size = 1500;
+// whether the stub accepts the binary `X' packet
+static bool has_x_packet = true;
+// whether the acks are turned off
+static bool noack = false;
+
+static void gdb_query_packet_size() {
+  static const char cmd[] = "qSupported";
+  gdb_send(conn, (const uint8_t *)cmd, sizeof(cmd) - 1);
+  size_t size;
+  uint8_t *reply = gdb_recv(conn, &size);
+  char *p = strstr((const char *)reply, "PacketSize=");
+  if (p != NULL) {
+    int n = strtol(p + strlen("PacketSize="), NULL, 16);
+    if (n > 64) packet_size = n;
+  }
+  free(reply);
+}
+
 bool gdb_connect_qemu(int port) {
   // connect to gdbserver on localhost port 1234
   while ((conn = gdb_begin_inet("127.0.0.1", port)) == NULL) {
     usleep(1);
   }
 
+  gdb_query_packet_size();
+  // every packet is checksummed and TCP is reliable, so the acks are only round trips
+  noack = gdb_start_noack(conn)[0] != '\0';
   return true;
 }
 
+static bool gdb_reply_ok() {
+  size_t size;
+  uint8_t *reply = gdb_recv(conn, &size);
+  bool ok = !strcmp((const char*)reply, "OK");
+  free(reply);
+  return ok;
+}
+
 static bool gdb_memcpy_to_qemu_small(uint32_t dest, void *src, int len) {
   char *buf = malloc(len * 2 + 128);
   assert(buf != NULL);
   int p = sprintf(buf, "M0x%x,%x:", dest, len);
   int i;
   for (i = 0; i < len; i ++) {
-    p += sprintf(buf + p, "%c%c", hex_encode(((uint8_t *)src)[i] >> 4), hex_encode(((uint8_t *)src)[i] & 0xf));
+    uint8_t c = ((uint8_t *)src)[i];
+    buf[p ++] = hex_encode(c >> 4);
+    buf[p ++] = hex_encode(c & 0xf);
   }
 
-  gdb_send(conn, (const uint8_t *)buf, strlen(buf));
+  gdb_send(conn, (const uint8_t *)buf, p);
+  free(buf);
+  return gdb_reply_ok();
+}
+
+// Send as many bytes as fit in one binary `X' packet, and return the number of them.
+// Return 0 if the stub does not support `X'.
+static int gdb_memcpy_to_qemu_binary(uint32_t dest, void *src, int len, bool *ok) {
+  char *buf = malloc(packet_size + 32);
+  assert(buf != NULL);
+  // leave room for the header, whose length depends on the final byte count
+  int limit = packet_size - 32;
+  int n = 0, payload = 0;
+  for (n = 0; n < len; n ++) {
+    uint8_t c = ((uint8_t *)src)[n];
+    int w = (c == '#' || c == '$' || c == '}' || c == '*') ? 2 : 1;
+    if (payload + w > limit) break;
+    payload += w;
+  }
+
+  int p = sprintf(buf, "X%x,%x:", dest, n);
+  for (int i = 0; i < n; i ++) {
+    uint8_t c = ((uint8_t *)src)[i];
+    if (c == '#' || c == '$' || c == '}' || c == '*') {
+      buf[p ++] = '}';
+      c ^= 0x20;
+    }
+    buf[p ++] = c;
+  }
+
+  gdb_send(conn, (const uint8_t *)buf, p);
   free(buf);
 
   size_t size;
   uint8_t *reply = gdb_recv(conn, &size);
-  bool ok = !strcmp((const char*)reply, "OK");
+  if (size == 0) {
+    // an empty reply means the packet is not supported
+    free(reply);
+    has_x_packet = false;
+    return 0;
+  }
+  *ok = !strcmp((const char*)reply, "OK");
   free(reply);
-
-  return ok;
+  return n;
 }
 
 bool gdb_memcpy_to_qemu(uint32_t dest, void *src, int len) {
-  const int mtu = 1500;
   bool ok = true;
-  while (len > mtu) {
-    ok &= gdb_memcpy_to_qemu_small(dest, src, mtu);
-    dest += mtu;
-    src += mtu;
-    len -= mtu;
+  while (len > 0 && has_x_packet) {
+    int n = gdb_memcpy_to_qemu_binary(dest, src, len, &ok);
+    if (!ok) return false;
+    dest += n;
+    src += n;
+    len -= n;
+  }
+
+  // fall back to hex-encoded `M' packets
+  const int mtu = (packet_size - 32) / 2;
+  while (len > 0) {
+    int n = len < mtu ? len : mtu;
+    ok &= gdb_memcpy_to_qemu_small(dest, src, n);
+    dest += n;
+    src += n;
+    len -= n;
   }
-  ok &= gdb_memcpy_to_qemu_small(dest, src, len);
   return ok;
 }
 
+bool gdb_memcpy_from_qemu(uint32_t src, void *dest, int len) {
+  const int mtu = (packet_size - 32) / 2;
+  char cmd[64];
+  while (len > 0) {
+    int n = len < mtu ? len : mtu;
+    int cmd_len = sprintf(cmd, "m%x,%x", src, n);
+    gdb_send(conn, (const uint8_t *)cmd, cmd_len);
+    size_t size;
+    uint8_t *reply = gdb_recv(conn, &size);
+    if (size != n * 2) {
+      free(reply);
+      return false;
+    }
+    for (int i = 0; i < n; i ++) {
+      ((uint8_t *)dest)[i] = gdb_decode_hex(reply[2 * i], reply[2 * i + 1]);
+    }
+    free(reply);
+    src += n;
+    dest += n;
+    len -= n;
+  }
+  return true;
+}
+
 bool gdb_getregs(union isa_gdb_regs *r) {
   gdb_send(conn, (const uint8_t *)"g", 1);
   size_t size;
@@ -113,6 +214,31 @@ bool gdb_si() {
   return true;
 }
 
+bool gdb_has_noack() {
+  return noack;
+}
+
+bool gdb_set_breakpoint(uint32_t addr, bool set) {
+  char buf[32];
+  // the kind is ignored by QEMU
+  int len = sprintf(buf, "%c0,%x,4", set ? 'Z' : 'z', addr);
+  gdb_send(conn, (const uint8_t *)buf, len);
+  return gdb_reply_ok();
+}
+
+// Continue until a breakpoint is hit. If it is not hit within `timeout_ms',
+// stop QEMU and return false.
+bool gdb_continue(int timeout_ms) {
+  static const char cmd[] = "vCont;c";
+  gdb_send(conn, (const uint8_t *)cmd, sizeof(cmd) - 1);
+  bool hit = gdb_poll(conn, timeout_ms);
+  if (!hit) gdb_interrupt(conn);
+  size_t size;
+  uint8_t *reply = gdb_recv(conn, &size);
+  free(reply);
+  return hit;
+}
+
 void gdb_exit() {
   gdb_end(conn);
 }
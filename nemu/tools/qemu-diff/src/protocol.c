@@ -28,6 +28,7 @@
 
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <poll.h>
 
 struct gdb_conn {
   FILE *in;
@@ -303,3 +304,15 @@ const char* gdb_start_noack(struct gdb_conn *conn) {
     conn->ack = false;
   return ok ? "OK" : "";
 }
+
+bool gdb_poll(struct gdb_conn *conn, int timeout_ms) {
+  // only valid if nothing is left in the buffer of `in', which holds
+  // when there is no ack between the packets
+  struct pollfd pfd = { .fd = fileno(conn->in), .events = POLLIN };
+  return poll(&pfd, 1, timeout_ms) > 0;
+}
+
+void gdb_interrupt(struct gdb_conn *conn) {
+  fputc(0x03, conn->out);
+  fflush(conn->out);
+}
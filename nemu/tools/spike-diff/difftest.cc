@@ -39,8 +39,13 @@ static debug_module_config_t difftest_dm_config = {
 struct diff_context_t {
   word_t gpr[MUXDEF(CONFIG_RVE, 16, 32)];
   word_t pc;
+  word_t mstatus, mepc, mcause, mtvec, satp, mie;
 };
 
+// in the order of diff_context_t
+static const int diff_csr[] = { CSR_MSTATUS, CSR_MEPC, CSR_MCAUSE, CSR_MTVEC, CSR_SATP, CSR_MIE };
+static_assert(sizeof(diff_context_t) == DIFFTEST_REG_SIZE, "layout of the registers of difftest");
+
 static sim_t* s = NULL;
 static processor_t *p = NULL;
 static state_t *state = NULL;
@@ -54,27 +59,47 @@ void sim_t::diff_step(uint64_t n) {
   step(n);
 }
 
+// the i-th word of diff_context_t
+static word_t diff_get_reg(int i) {
+  if (i < NR_GPR) return state->XPR[i];
+  if (i == NR_GPR) return state->pc;
+  return p->get_csr(diff_csr[i - NR_GPR - 1]);
+}
+
+static void diff_set_reg(int i, word_t val) {
+  if (i < NR_GPR) state->XPR.write(i, (sword_t)val);
+  else if (i == NR_GPR) state->pc = val;
+  else p->put_csr(diff_csr[i - NR_GPR - 1], val);
+}
+
 void sim_t::diff_get_regs(void* diff_context) {
-  struct diff_context_t* ctx = (struct diff_context_t*)diff_context;
-  for (int i = 0; i < NR_GPR; i++) {
-    ctx->gpr[i] = state->XPR[i];
+  word_t* ctx = (word_t*)diff_context;
+  for (int i = 0; i < DIFFTEST_NR_REG; i++) {
+    ctx[i] = diff_get_reg(i);
   }
-  ctx->pc = state->pc;
 }
 
 void sim_t::diff_set_regs(void* diff_context) {
-  struct diff_context_t* ctx = (struct diff_context_t*)diff_context;
-  for (int i = 0; i < NR_GPR; i++) {
-    state->XPR.write(i, (sword_t)ctx->gpr[i]);
+  word_t* ctx = (word_t*)diff_context;
+  for (int i = 0; i < DIFFTEST_NR_REG; i++) {
+    diff_set_reg(i, ctx[i]);
   }
-  state->pc = ctx->pc;
+}
+
+// copy directly from/to the backing store of the memory instead of
+// going through the MMU one byte at a time
+static void diff_mem_access(reg_t addr, void* buf, size_t n, bool to_ref) {
+  mem_t* mem = difftest_mem[0].second;
+  reg_t offset = addr - difftest_mem[0].first;
+  assert(addr >= difftest_mem[0].first && offset + n <= mem->size());
+  bool ok = to_ref ? mem->store(offset, n, (const uint8_t*)buf) : mem->load(offset, n, (uint8_t*)buf);
+  assert(ok);
 }
 
 void sim_t::diff_memcpy(reg_t dest, void* src, size_t n) {
-  mmu_t* mmu = p->get_mmu();
-  for (size_t i = 0; i < n; i++) {
-    mmu->store<uint8_t>(dest+i, *((uint8_t*)src+i));
-  }
+  diff_mem_access(dest, src, n, true);
+  // the decoded instructions cached by the MMU may be overwritten
+  p->get_mmu()->flush_icache();
 }
 
 extern "C" {
@@ -83,7 +108,7 @@ __EXPORT void difftest_memcpy(paddr_t addr, void *buf, size_t n, bool direction)
   if (direction == DIFFTEST_TO_REF) {
     s->diff_memcpy(addr, buf, n);
   } else {
-    assert(0);
+    diff_mem_access(addr, buf, n, false);
   }
 }
 
@@ -95,6 +120,15 @@ __EXPORT void difftest_regcpy(void* dut, bool direction) {
   }
 }
 
+__EXPORT void difftest_regcpy_mask(void* dut, uint64_t mask, bool direction) {
+  word_t* ctx = (word_t*)dut;
+  for (; mask != 0; mask &= mask - 1) {
+    int i = __builtin_ctzll(mask);
+    if (direction == DIFFTEST_TO_REF) diff_set_reg(i, ctx[i]);
+    else ctx[i] = diff_get_reg(i);
+  }
+}
+
 __EXPORT void difftest_exec(uint64_t n) {
   s->diff_step(n);
 }